@@ -35,6 +35,24 @@ extern "C" {
 
 #define ALL_PROCESSES (-1)
 
+/** Size of ProcessTree_T.comm, the same as the name buffer of the stat parser so that no name is cut twice */
+#define PROCESS_TREE_COMM_LEN 64
+
+/**
+ * Statistics collected by ProcessTree_init(). The stat file of every process is always read, it provides the parent,
+ * threads, cpu and memory, the other flags each enable one or two more files per process.
+ */
+typedef enum {
+    ProcessTree_CollectCpu = 0x1,               // cpu
+    ProcessTree_CollectMemory = 0x2,            // memory
+    ProcessTree_CollectIo = 0x4,                // read and write
+    ProcessTree_CollectCred = 0x8,              // cred
+    ProcessTree_CollectFileDescriptors = 0x10,  // filedescriptors
+    ProcessTree_CollectCmdline = 0x20,          // cmdline, NULL if not collected
+    ProcessTree_CollectSecattr = 0x40,          // secattr, NULL if not collected
+    ProcessTree_CollectAll = 0x7F
+} ProcessTree_Flags;
+
 typedef struct ProcessTree_T {
     bool visited;
     bool zombie;
@@ -64,8 +82,8 @@ typedef struct ProcessTree_T {
 
     struct {
         int count;
-        int total;
-        int *list;
+        int total;  // All descendants
+        int *list;  // Range of one array holding the children of all processes, NULL if there are none
     } children;
 
     struct {
@@ -73,6 +91,15 @@ typedef struct ProcessTree_T {
         unsigned long long usage_total;
     } memory;
 
+    struct {
+        unsigned long minor;
+        unsigned long major;
+    } faults;
+
+    int processor;  // CPU the process last ran on, -1 if unknown
+    long priority;
+    long nice;
+
     struct {
         unsigned long long time;
         long long bytes;
@@ -88,6 +115,8 @@ typedef struct ProcessTree_T {
     } write;
 
     time_t uptime;
+    unsigned long long starttime;  // Clock ticks after boot, tells a reused pid apart
+    char comm[PROCESS_TREE_COMM_LEN];  // Name from the stat file, kernel worker names can be longer than 15
     char *cmdline;
     char *secattr;
 
@@ -104,14 +133,92 @@ typedef struct ProcessTree_T {
     double time;
 } ProcessTree_T;
 
+/**
+ * State kept from one ProcessTree_init() call to the next one of the same tree, such as the pid lookup index of the
+ * current snapshot. A context must not be shared by trees of different pids.
+ *
+ * The context owns the memory of the tree: every snapshot is allocated from one of two arenas which take turns, so
+ * the previous snapshot can be read while the next one is built and the memory of the one before is reused. A pinned
+ * snapshot keeps its arena, the next ones are built in others until it is unpinned.
+ */
+typedef struct ProcessTree_Context *ProcessTree_Context_T;
+
+/**
+ * Create a process tree context
+ * @return A new context
+ */
+ProcessTree_Context_T ProcessTree_Context_new(void);
+
+/**
+ * Destroy a process tree context and the memory of its trees
+ */
+void ProcessTree_Context_free(ProcessTree_Context_T *pContext);
+
+/**
+ * Set the number of threads reading /proc in ProcessTree_init(). The processes are split in shards which are read in
+ * parallel, the resulting tree is the same as when read serially.
+ * @param workers Number of threads including the caller of ProcessTree_init(), 1 (the default) reads /proc serially
+ */
+void ProcessTree_Context_setWorkers(ProcessTree_Context_T context, int workers);
+
+/**
+ * Keep the current tree of the context valid after the following ProcessTree_init() calls, so other threads can read
+ * it while the next trees are built. The tree must not be modified while pinned. Pins are counted.
+ * @return The pin to pass to ProcessTree_Context_unpin()
+ */
+int ProcessTree_Context_pin(ProcessTree_Context_T context);
+
+/**
+ * Release a pin, the memory of the tree is reused once it is not pinned anymore and not the current tree. May be
+ * called from any thread.
+ */
+void ProcessTree_Context_unpin(ProcessTree_Context_T context, int pin);
+
+/**
+ * Count the arenas holding a pinned tree. Each of them is one more arena allocated for the next trees, a caller
+ * keeping trees for long can copy them instead of pinning past a limit. May be called from any thread.
+ * @return The number of pinned arenas
+ */
+int ProcessTree_Context_pinned(ProcessTree_Context_T context);
+
 /**
  * Initialize the process tree
+ * @param context The context *ppTree was initialized with, or a new one if *ppTree is NULL
+ * @param pflags Statistics to collect, a combination of ProcessTree_Flags
  * @return The process tree size or -1 if failed
  */
-int ProcessTree_init(ProcessTree_T **ppTree, int *pTreeSize, int pid);
+int ProcessTree_init(ProcessTree_T **ppTree, int *pTreeSize, ProcessTree_Context_T context, int pid, int pflags);
+
+/**
+ * Collect more statistics of one process of the tree, so a tree initialized with only the statistics to rank the
+ * processes by can fetch the expensive ones for the few processes shown
+ * @param context The context the tree was initialized with
+ * @param index Index of the process in the tree
+ * @param pflags Statistics to collect, a combination of ProcessTree_Flags
+ * @return true if succeeded, false if the process exited or the reads failed
+ */
+bool ProcessTree_collect(ProcessTree_T *pTree, int treeSize, ProcessTree_Context_T context, int index, int pflags);
+
+/**
+ * Returns the children of a process
+ * @param index Index of the process in the tree
+ * @param pChildren Set to the indexes of the children, NULL if there are none
+ * @return The number of children
+ */
+int ProcessTree_children(const ProcessTree_T *pTree, int treeSize, int index, const int **pChildren);
+
+/**
+ * Collect the indexes of all descendants of a process in breadth-first order, e.g. to sum up a service's processes
+ * @param index Index of the process in the tree
+ * @param descendants Buffer for the indexes, pTree[index].children.total entries are enough
+ * @param size Number of entries of the buffer
+ * @return The number of descendants or -1 if the buffer is too small
+ */
+int ProcessTree_descendants(const ProcessTree_T *pTree, int treeSize, int index, int *descendants, int size);
 
 /**
- * Delete the process tree
+ * Delete the process tree. Its memory is reused by the next ProcessTree_init() with the same context or freed by
+ * ProcessTree_Context_free().
  */
 void ProcessTree_delete(ProcessTree_T **ppTree, int *pTreeSize);
 
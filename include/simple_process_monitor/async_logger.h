@@ -0,0 +1,107 @@
+#ifndef SIMPLE_PROCESS_MONITOR_ASYNC_LOGGER_H
+#define SIMPLE_PROCESS_MONITOR_ASYNC_LOGGER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace simple_process_monitor {
+
+enum class OverflowPolicy {
+    DROP = 0,  // A record which finds the ring full is dropped and counted
+    BLOCK      // The producer waits for room, up to blockTimeout, then drops the record
+};
+
+struct AsyncLoggerOptions {
+    size_t capacity = 1024;  // Records in the ring, rounded up to a power of two
+    size_t batchSize = 64;   // Records handed to the sink in one call at most
+    OverflowPolicy policy = OverflowPolicy::DROP;
+    std::chrono::milliseconds blockTimeout{100};
+};
+
+struct AsyncLoggerStats {
+    uint64_t enqueued;
+    uint64_t dropped;
+    uint64_t batches;  // Calls of the sink
+    uint64_t failed;   // Calls of the sink which returned a negative value, their records are lost
+};
+
+// Decouples producers from a slow sink: records are enqueued into a bounded lock-free ring by any number of threads,
+// and a background thread drains it, concatenating up to batchSize records per sink call. An enqueue takes no lock
+// unless the drainer sleeps on an empty ring. Records still queued are written when the logger is destroyed.
+//
+// An AsyncLogger can be passed as the sink of ProcessMonitor's log functions.
+class AsyncLogger {
+public:
+    using SINK = std::function<int(std::string_view)>;
+
+    explicit AsyncLogger(SINK sink, AsyncLoggerOptions options = {});
+
+    ~AsyncLogger();
+
+    AsyncLogger(const AsyncLogger &) = delete;
+    AsyncLogger &operator=(const AsyncLogger &) = delete;
+
+    // false if the record was dropped
+    bool log(std::string record);
+
+    int operator()(std::string_view record) {
+        return log(std::string{record}) ? static_cast<int>(record.size()) : -1;
+    }
+
+    // Waits until the records enqueued so far were written, up to the last position reserved by any producer
+    void flush();
+
+    [[nodiscard]] AsyncLoggerStats stats() const {
+        return {enqueued_.load(std::memory_order_relaxed),
+                dropped_.load(std::memory_order_relaxed),
+                batches_.load(std::memory_order_relaxed),
+                failed_.load(std::memory_order_relaxed)};
+    }
+
+private:
+    // A slot of Dmitry Vyukov's bounded queue: sequence == position when free for the producer of position, position
+    // + 1 when holding its record
+    struct Slot {
+        std::atomic<size_t> sequence;
+        std::string record;
+    };
+
+    bool tryEnqueue(std::string &record);
+
+    void drain();
+
+    const SINK sink_;
+    const AsyncLoggerOptions options_;
+    const size_t mask_;
+    const std::unique_ptr<Slot[]> slots_;
+
+    alignas(64) std::atomic<size_t> enqueuePosition_{0};
+    alignas(64) size_t dequeuePosition_ = 0;  // Drainer only
+    std::atomic<size_t> written_{0};          // Records written, the positions before it, for flush()
+
+    std::atomic<uint64_t> enqueued_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> batches_{0};
+    std::atomic<uint64_t> failed_{0};
+
+    std::mutex mutex_;
+    std::condition_variable wakeDrainer_;
+    std::condition_variable drained_;
+    std::atomic<bool> sleeping_{false};  // The drainer waits on wakeDrainer_
+    bool stopping_ = false;              // Guarded by mutex_
+
+    std::thread drainer_;
+};
+
+}  // namespace simple_process_monitor
+
+#endif
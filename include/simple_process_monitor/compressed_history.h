@@ -0,0 +1,127 @@
+#ifndef SIMPLE_PROCESS_MONITOR_COMPRESSED_HISTORY_H
+#define SIMPLE_PROCESS_MONITOR_COMPRESSED_HISTORY_H
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <simple_process_monitor/process_history.h>
+
+namespace simple_process_monitor {
+
+struct HistorySample {
+    long long time;  // Milliseconds
+    HistoryValues values;
+};
+
+// Samples of one process (or of the system) compressed in chunks of a fixed number of samples, as in Facebook's
+// Gorilla: timestamps as delta-of-delta, the CPU usage as the XOR with the previous value, and the counters (RSS, I/O
+// and descriptors, stored as integers) as zigzag varint deltas. A sample of a process which does not change costs a
+// few bits, an unchanged timestamp step one bit. Queries decode only the chunks overlapping the range.
+class CompressedSeries {
+public:
+    explicit CompressedSeries(size_t chunkSamples = 120);
+
+    // time is in milliseconds, not before the time of the last sample
+    void push(long long time, const HistoryValues &values);
+
+    // Samples with from <= time < to, oldest first
+    [[nodiscard]] std::vector<HistorySample> query(long long from, long long to) const;
+
+    // Drops the chunks whose samples are all older than time
+    void dropBefore(long long time);
+
+    [[nodiscard]] size_t samples() const;
+
+    // Memory of the chunks
+    [[nodiscard]] size_t bytes() const;
+
+private:
+    // A bit stream written most significant bit first
+    class BitWriter {
+    public:
+        void write(uint64_t value, int bits);
+
+        [[nodiscard]] const std::vector<uint8_t> &bytes() const {
+            return bytes_;
+        }
+
+        void shrink() {
+            bytes_.shrink_to_fit();
+        }
+
+    private:
+        std::vector<uint8_t> bytes_;
+        size_t bits_ = 0;
+    };
+
+    struct Chunk {
+        long long first = 0;  // Time of the first sample
+        long long last = 0;   // Time of the last sample
+        uint32_t count = 0;
+
+        BitWriter times;
+        BitWriter cpu;
+        std::vector<uint8_t> counters;  // Varint deltas of the counters of every sample, interleaved
+    };
+
+    // State of the encoder of the open chunk, the last sample
+    struct Encoder {
+        long long delta = 0;
+        uint64_t cpuBits = 0;
+        int leading = -1;  // Window of the meaningful bits of the last XOR, -1 if there was none
+        int trailing = 0;
+        long long counterValues[kHistoryMetricCount - 1] = {};
+    };
+
+    static void decode(const Chunk &chunk, long long from, long long to, std::vector<HistorySample> &samples);
+
+    const size_t chunkSamples_;
+
+    std::vector<Chunk> chunks_;  // Oldest first, the last one is open
+    Encoder encoder_;
+};
+
+// The compressed counterpart of ProcessHistory, for a long retention. Samples older than the retention are dropped a
+// chunk at a time, processes missing from a snapshot (or whose pid was reused) are dropped with their samples.
+// Nothing records by itself: feed it from ProcessMonitor::recordSamples(), or call record() on every refresh.
+class CompressedHistory {
+public:
+    explicit CompressedHistory(long long retention, size_t chunkSamples = 120);
+
+    // time is in milliseconds
+    void record(long long time, const ProcessTreeSnapshot &snapshot);
+
+    void record(long long time, const SystemInfo_T &systemInfo);
+
+    // nullptr if the process is not tracked
+    [[nodiscard]] const CompressedSeries *process(pid_t pid) const;
+
+    [[nodiscard]] const CompressedSeries &system() const {
+        return system_;
+    }
+
+    [[nodiscard]] size_t processes() const {
+        return series_.size();
+    }
+
+    [[nodiscard]] size_t samples() const;
+
+    [[nodiscard]] size_t bytes() const;
+
+private:
+    const long long retention_;
+    const size_t chunkSamples_;
+
+    CompressedSeries system_;
+
+    TrackedProcesses<CompressedSeries> series_;
+};
+
+}  // namespace simple_process_monitor
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef SIMPLE_PROCESS_MONITOR_JSON_WRITER_H
+#define SIMPLE_PROCESS_MONITOR_JSON_WRITER_H
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+#include <simple_process_monitor/process_tree_wrapper.h>
+#include <simple_process_monitor/system_info.h>
+
+namespace simple_process_monitor {
+
+// Length of the valid UTF-8 sequence at p, 0 if it is invalid
+size_t utf8Length(const unsigned char *p, const unsigned char *end);
+
+// Writes JSON as it goes into a caller buffer, without building a document and without allocating. A full buffer is
+// flushed to the output, if there is one, else the writer fails and ignores the rest. Numbers are formatted with
+// std::to_chars, strings are escaped and invalid UTF-8 is replaced with U+FFFD. Records ended with endRecord() make
+// NDJSON.
+class JsonWriter {
+public:
+    // Returns false if the data could not be written
+    using Flush = bool (*)(void *context, const char *data, size_t size);
+
+    // Into buf only
+    JsonWriter(char *buf, size_t size)
+        : JsonWriter(buf, size, nullptr, nullptr) {}
+
+    // Through buf into fd
+    JsonWriter(int fd, char *buf, size_t size)
+        : JsonWriter(buf, size, writeToFd, this) {
+        fd_ = fd;
+    }
+
+    JsonWriter(char *buf, size_t size, Flush output, void *context)
+        : buf_(buf)
+        , size_(size)
+        , flush_(output)
+        , context_(context) {}
+
+    JsonWriter(const JsonWriter &) = delete;
+    JsonWriter &operator=(const JsonWriter &) = delete;
+
+    JsonWriter &beginObject() {
+        return open('{');
+    }
+
+    JsonWriter &endObject() {
+        return close('}');
+    }
+
+    JsonWriter &beginArray() {
+        return open('[');
+    }
+
+    JsonWriter &endArray() {
+        return close(']');
+    }
+
+    JsonWriter &key(std::string_view name);
+
+    // nullptr is null
+    JsonWriter &value(const char *s);
+
+    JsonWriter &value(std::string_view s);
+
+    JsonWriter &value(bool b) {
+        separate();
+        write(b ? "true" : "false");
+        return *this;
+    }
+
+    template <typename T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int> = 0>
+    JsonWriter &value(T n) {
+        char buf[24];
+
+        separate();
+        write(buf, static_cast<size_t>(std::to_chars(buf, buf + sizeof(buf), n).ptr - buf));
+        return *this;
+    }
+
+    // The shortest representation which reads back as the same float (or double), null if not finite
+    JsonWriter &value(float x);
+
+    JsonWriter &value(double x);
+
+    JsonWriter &null() {
+        separate();
+        write("null");
+        return *this;
+    }
+
+    // Ends a record of NDJSON
+    JsonWriter &endRecord() {
+        write("\n");
+        return *this;
+    }
+
+    // Writes the buffered data to the output, if there is one
+    bool flush();
+
+    // false once data was lost
+    [[nodiscard]] bool ok() const {
+        return ok_;
+    }
+
+    // What is buffered, all that was written if there is no output
+    [[nodiscard]] std::string_view view() const {
+        return {buf_, used_};
+    }
+
+private:
+    static constexpr int kMaxDepth = 64;
+
+    static bool writeToFd(void *context, const char *data, size_t size);
+
+    JsonWriter &open(char c);
+
+    JsonWriter &close(char c);
+
+    // Writes the comma before an element
+    void separate();
+
+    void write(std::string_view s) {
+        write(s.data(), s.size());
+    }
+
+    void write(const char *data, size_t size);
+
+    void writeString(std::string_view s);
+
+    char *const buf_;
+    const size_t size_;
+    size_t used_ = 0;
+    const Flush flush_;
+    void *const context_;
+    bool ok_ = true;
+
+    int fd_ = -1;
+    int depth_ = 0;
+    uint64_t hasElements_ = 0;  // Bit i is set once the container at depth i + 1 has an element
+    bool afterKey_ = false;
+};
+
+// The objects of the library, to be written as a value
+void writeJson(JsonWriter &writer, const ProcessOrThreadInfo &info);
+void writeJsonMembers(JsonWriter &writer, const ProcessOrThreadInfo &info);  // Into an object opened by the caller
+void writeJson(JsonWriter &writer, const TopProcessInfos &infos);
+void writeJson(JsonWriter &writer, const ProcessTree_T &process);
+void writeJson(JsonWriter &writer, const SystemInfo_T &systemInfo);
+
+}  // namespace simple_process_monitor
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef SIMPLE_PROCESS_MONITOR_LATEST_PTR_H
+#define SIMPLE_PROCESS_MONITOR_LATEST_PTR_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace simple_process_monitor {
+
+// The latest shared_ptr stored by one writer, loaded by any thread without locks: std::atomic_load of a shared_ptr
+// takes a lock in libstdc++. The pointer lives in one of a few slots, a reader announces itself in the current slot
+// before copying its pointer, and the writer only replaces the pointer of a slot which is neither current nor
+// announced. A reader retries only when a store moved the current slot meanwhile.
+template <typename T>
+class LatestPtr {
+public:
+    LatestPtr() = default;
+
+    LatestPtr(const LatestPtr &) = delete;
+    LatestPtr &operator=(const LatestPtr &) = delete;
+
+    // May be called from any thread
+    [[nodiscard]] std::shared_ptr<T> load() const {
+        for (;;) {
+            const size_t slot = current_.load();
+
+            readers_[slot].fetch_add(1);
+
+            // The slot is still current after the announcement, so the writer cannot replace its pointer until the
+            // reader leaves
+            if (current_.load() == slot) {
+                std::shared_ptr<T> ptr = slots_[slot];
+
+                readers_[slot].fetch_sub(1);
+                return ptr;
+            }
+
+            readers_[slot].fetch_sub(1);
+        }
+    }
+
+    // From one thread at a time. The pointers of the previous slots are released unless a reader is copying one, so
+    // the previous objects are not kept alive by the slots.
+    void store(std::shared_ptr<T> ptr) {
+        const size_t current = current_.load(std::memory_order_relaxed);
+
+        for (size_t i = next(current);; i = next(i)) {
+            if (i == current) {
+                std::this_thread::yield();
+            } else if (readers_[i].load() == 0) {
+                slots_[i] = std::move(ptr);
+                current_.store(i);
+                release(i);
+                return;
+            }
+        }
+    }
+
+private:
+    static constexpr size_t kSlots = 4;
+
+    static size_t next(size_t slot) {
+        return (slot + 1) % kSlots;
+    }
+
+    void release(size_t current) {
+        for (size_t i = 0; i < kSlots; i++) {
+            if (i != current && slots_[i] && readers_[i].load() == 0) {
+                slots_[i].reset();
+            }
+        }
+    }
+
+    std::array<std::shared_ptr<T>, kSlots> slots_;
+    mutable std::array<std::atomic<int>, kSlots> readers_{};
+    std::atomic<size_t> current_{0};
+};
+
+}  // namespace simple_process_monitor
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef SIMPLE_PROCESS_MONITOR_METRICS_EXPORTER_H
+#define SIMPLE_PROCESS_MONITOR_METRICS_EXPORTER_H
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <simple_process_monitor/latest_ptr.h>
+#include <simple_process_monitor/process_tree_wrapper.h>
+#include <simple_process_monitor/report_builder.h>
+#include <simple_process_monitor/system_info.h>
+
+namespace simple_process_monitor {
+
+// Which processes get per-process metrics, the system metrics are always exported
+struct MetricsExporterOptions {
+    size_t topK = 10;         // Top processes by CPU usage and by RAM usage, 0 for none
+    std::vector<pid_t> pids;  // Processes exported besides the top ones
+};
+
+// Serves the system and per-process metrics of the last snapshot over HTTP in the OpenMetrics text format. Each
+// update renders the whole response, headers included, once. A scrape is then answered with a single write of those
+// bytes, however many scrapers there are. Connections are served one at a time on non-blocking sockets, each within a
+// deadline, so a silent or stalled scraper cannot hold up the others for long.
+class MetricsExporter {
+public:
+    explicit MetricsExporter(MetricsExporterOptions options = {});
+
+    ~MetricsExporter() {
+        stop();
+    }
+
+    MetricsExporter(const MetricsExporter &) = delete;
+    MetricsExporter &operator=(const MetricsExporter &) = delete;
+
+    // Serves on address:port from a background thread, port 0 picks a free one. false with errno set on failure.
+    bool listen(uint16_t port, const std::string &address = "127.0.0.1");
+
+    void stop();
+
+    // The port served on, 0 if not listening
+    [[nodiscard]] uint16_t port() const {
+        return port_;
+    }
+
+    // Renders the response scrapes get from now on, may be called from any one thread
+    void update(const ProcessTreeSnapshot &snapshot, const SystemInfo_T &systemInfo);
+
+    // The response of the last update, an empty exposition before the first one
+    [[nodiscard]] std::shared_ptr<const std::string> response() const {
+        return response_.load();
+    }
+
+private:
+    void renderBody(const ProcessTreeSnapshot &snapshot, const SystemInfo_T &systemInfo);
+
+    void serve();
+
+    const MetricsExporterOptions options_;
+
+    ReportBuilder body_;                      // Rendered by update, reused
+    std::shared_ptr<std::string> published_;  // Buffer of the response scrapers get now
+    std::shared_ptr<std::string> spare_;      // Response buffer reused once scrapers released it
+    LatestPtr<const std::string> response_;
+
+    int listenFd_ = -1;
+    int wakeFd_ = -1;  // eventfd which stops the server thread
+    uint16_t port_ = 0;
+    std::thread server_;
+};
+
+}  // namespace simple_process_monitor
+
+#endif
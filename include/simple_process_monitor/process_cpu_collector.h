@@ -0,0 +1,69 @@
+#ifndef SIMPLE_PROCESS_MONITOR_PROCESS_CPU_COLLECTOR_H
+#define SIMPLE_PROCESS_MONITOR_PROCESS_CPU_COLLECTOR_H
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <simple_process_monitor/process_tree_wrapper.h>
+
+namespace simple_process_monitor {
+
+// Top threads of every process of a top list, in the same order
+using TopProcessThreadInfos = std::vector<TopProcessInfos>;
+
+// Top processes of the system by CPU usage together with their top threads, both measured over the same interval.
+// The thread trees of the candidates, the top processes of the previous update, are refreshed right after the process
+// tree, so no extra interval is waited for the threads. Until the first ranking the candidates are the processes which
+// used the most CPU time so far. Only the candidates have a thread tree, whatever the number of processes.
+class ProcessCpuCollector {
+public:
+    // count processes with count threads each. candidates >= count processes keep their thread tree between updates,
+    // a process climbing into the top count from further down has no threads for one interval. pflags collects more
+    // statistics of the process tree, to rank it by them too.
+    explicit ProcessCpuCollector(int count, int candidates = 0, int pflags = ProcessTree_CollectCpu, int workers = 1);
+
+    ProcessCpuCollector(const ProcessCpuCollector &) = delete;
+    ProcessCpuCollector &operator=(const ProcessCpuCollector &) = delete;
+
+    void update();
+
+    // Of the last update, empty after the first one which has no CPU usages yet
+    [[nodiscard]] const TopProcessInfos &processes() const {
+        return processes_;
+    }
+
+    // Top threads of every process in processes()
+    [[nodiscard]] const TopProcessThreadInfos &threads() const {
+        return threads_;
+    }
+
+    // Processes whose thread tree is kept, at most candidates
+    [[nodiscard]] size_t tracked() const {
+        return threadTreeWrappers_.size();
+    }
+
+    // The process tree of the last update
+    [[nodiscard]] ProcessTreeWrapper &processTreeWrapper() {
+        return processTreeWrapper_;
+    }
+
+private:
+    void track(const std::vector<pid_t> &candidates);
+
+    const int count_;
+    const int candidates_;
+
+    ProcessTreeWrapper processTreeWrapper_;
+    std::unordered_map<pid_t, std::unique_ptr<ProcessTreeWrapper>> threadTreeWrappers_;
+
+    TopProcessInfos processes_;
+    TopProcessThreadInfos threads_;
+};
+
+}  // namespace simple_process_monitor
+
+#endif
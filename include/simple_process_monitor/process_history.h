@@ -0,0 +1,228 @@
+#ifndef SIMPLE_PROCESS_MONITOR_PROCESS_HISTORY_H
+#define SIMPLE_PROCESS_MONITOR_PROCESS_HISTORY_H
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <simple_process_monitor/process_tree_wrapper.h>
+#include <simple_process_monitor/system_info.h>
+
+namespace simple_process_monitor {
+
+enum class HistoryMetric {
+    CPU = 0,          // Usage [%], -1 if unknown
+    RSS,              // Resident memory [B]
+    IO,               // Bytes read and written since the process started, 0 if not collected
+    FILE_DESCRIPTORS  // Open file descriptors, 0 if not collected
+};
+
+constexpr size_t kHistoryMetricCount = 4;
+
+// One sample of every metric, indexed by HistoryMetric
+using HistoryValues = std::array<double, kHistoryMetricCount>;
+
+// The metrics of a process, and of the system: CPU usage besides idle, memory in use, no I/O and allocated descriptors
+HistoryValues historyValuesOf(const ProcessTree_T &process);
+HistoryValues historyValuesOf(const SystemInfo_T &systemInfo);
+
+// A range of a column, oldest first. The ring stores it in at most two contiguous pieces: second is empty unless the
+// range wraps around the end of the ring.
+template <typename V>
+struct ColumnRange {
+    const V *first;
+    size_t firstSize;
+    const V *second;
+    size_t secondSize;
+
+    [[nodiscard]] size_t size() const {
+        return firstSize + secondSize;
+    }
+
+    [[nodiscard]] V operator[](size_t i) const {
+        return i < firstSize ? first[i] : second[i - firstSize];
+    }
+};
+
+// The last capacity samples of a process (or of the system), one contiguous column per metric so a range query of one
+// metric reads sequential memory. The memory is allocated once, a full ring overwrites its oldest sample.
+class HistoryRing {
+public:
+    explicit HistoryRing(size_t capacity);
+
+    // time is in milliseconds, not before the time of the last sample
+    void push(long long time, const HistoryValues &values);
+
+    void clear() {
+        head_ = size_ = 0;
+    }
+
+    [[nodiscard]] size_t size() const {
+        return size_;
+    }
+
+    [[nodiscard]] size_t capacity() const {
+        return times_.size();
+    }
+
+    // Indexes [begin, end) of the samples with from <= time < to, 0 is the oldest sample
+    [[nodiscard]] std::pair<size_t, size_t> find(long long from, long long to) const;
+
+    // Samples [begin, end), 0 is the oldest sample
+    [[nodiscard]] ColumnRange<long long> times(size_t begin, size_t end) const;
+
+    [[nodiscard]] ColumnRange<double> values(HistoryMetric metric, size_t begin, size_t end) const;
+
+    // Memory of the columns
+    [[nodiscard]] size_t bytes() const {
+        return bytesOf(capacity());
+    }
+
+    // Memory of the columns of a ring of capacity samples
+    static constexpr size_t bytesOf(size_t capacity) {
+        return capacity * (sizeof(long long) + kHistoryMetricCount * sizeof(double));
+    }
+
+private:
+    // Position of the i-th oldest sample in the columns
+    [[nodiscard]] size_t position(size_t i) const {
+        const size_t p = head_ + capacity() - size_ + i;
+
+        return p < capacity() ? p : p - capacity();
+    }
+
+    template <typename V>
+    ColumnRange<V> range(const std::vector<V> &column, size_t begin, size_t end) const;
+
+    std::vector<long long> times_;
+    std::array<std::vector<double>, kHistoryMetricCount> values_;
+    size_t head_ = 0;  // Position of the next sample
+    size_t size_ = 0;
+};
+
+// The series of the processes of a process tree by pid, for the histories. A process is tracked from the first
+// snapshot it is in until the first one it is not in anymore. A pid reused by a process with another start time is
+// another process, the series of the one which exited is evicted as well.
+template <typename Series>
+class TrackedProcesses {
+public:
+    struct Tracked {
+        Series series;
+        unsigned long long starttime;
+        unsigned generation;  // Of the last snapshot the process was in
+    };
+
+    using Map = std::unordered_map<pid_t, Tracked>;
+
+    // Evicts the processes which are not in snapshot, passing their series to evicted, before the processes of the
+    // snapshot are found or tracked
+    template <typename Evicted>
+    void evict(const ProcessTreeSnapshot &snapshot, Evicted &&evicted) {
+        generation_++;
+
+        for (const ProcessTree_T &p : snapshot) {
+            auto it = tracked_.find(p.pid);
+
+            if (it != tracked_.end() && it->second.starttime == p.starttime) {
+                it->second.generation = generation_;
+            }
+        }
+
+        for (auto it = tracked_.begin(); it != tracked_.end();) {
+            if (it->second.generation != generation_) {
+                evicted(std::move(it->second.series));
+                it = tracked_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void evict(const ProcessTreeSnapshot &snapshot) {
+        evict(snapshot, [](Series &&) {});
+    }
+
+    // Of a process of the last evicted snapshot, nullptr if the process is not tracked
+    [[nodiscard]] Series *find(const ProcessTree_T &process) {
+        auto it = tracked_.find(process.pid);
+
+        return it != tracked_.end() ? &it->second.series : nullptr;
+    }
+
+    [[nodiscard]] const Series *find(pid_t pid) const {
+        auto it = tracked_.find(pid);
+
+        return it != tracked_.end() ? &it->second.series : nullptr;
+    }
+
+    // Of a process of the last evicted snapshot which is not tracked yet
+    Series &track(const ProcessTree_T &process, Series series) {
+        return tracked_.emplace(process.pid, Tracked{std::move(series), process.starttime, generation_})
+            .first->second.series;
+    }
+
+    [[nodiscard]] size_t size() const {
+        return tracked_.size();
+    }
+
+    [[nodiscard]] typename Map::const_iterator begin() const {
+        return tracked_.begin();
+    }
+
+    [[nodiscard]] typename Map::const_iterator end() const {
+        return tracked_.end();
+    }
+
+private:
+    Map tracked_;
+    unsigned generation_ = 0;
+};
+
+// Rings of the processes of a process tree and of the system, with a fixed memory budget. A process is tracked from
+// the first snapshot it is in until the first one it is not in anymore (or its pid is reused), then its ring is reused
+// for another process.
+// Processes found while the budget is used up are not tracked until exited processes make room.
+// Nothing records by itself: feed it from ProcessMonitor::recordSamples(), or call record() on every refresh.
+class ProcessHistory {
+public:
+    // Every ring holds samples samples, all rings together (the system's too) take at most maxBytes
+    ProcessHistory(size_t samples, size_t maxBytes);
+
+    // time is in milliseconds
+    void record(long long time, const ProcessTreeSnapshot &snapshot);
+
+    void record(long long time, const SystemInfo_T &systemInfo);
+
+    // nullptr if the process is not tracked
+    [[nodiscard]] const HistoryRing *process(pid_t pid) const;
+
+    [[nodiscard]] const HistoryRing &system() const {
+        return system_;
+    }
+
+    [[nodiscard]] size_t processes() const {
+        return rings_.size();
+    }
+
+    // Memory of all rings, including the ones kept for reuse
+    [[nodiscard]] size_t bytes() const;
+
+private:
+    const size_t samples_;
+    const size_t maxRings_;  // Of processes
+
+    HistoryRing system_;
+
+    TrackedProcesses<std::unique_ptr<HistoryRing>> rings_;
+    std::vector<std::unique_ptr<HistoryRing>> spare_;  // Rings of exited processes, reused before allocating
+};
+
+}  // namespace simple_process_monitor
+
+#endif
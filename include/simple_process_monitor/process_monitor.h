@@ -5,55 +5,195 @@
 #include <unistd.h>
 
 #include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <string_view>
 #include <thread>
+#include <utility>
 #include <vector>
 
+#include <simple_process_monitor/latest_ptr.h>
+#include <simple_process_monitor/metrics_exporter.h>
+#include <simple_process_monitor/process_cpu_collector.h>
 #include <simple_process_monitor/process_tree_wrapper.h>
+#include <simple_process_monitor/report_builder.h>
 #include <simple_process_monitor/system_info.h>
+#include <simple_process_monitor/thread_cpu_collector.h>
 
 namespace simple_process_monitor {
 
+enum class ReportFormat {
+    TEXT = 0,
+    NDJSON  // One JSON object per report, ended by a newline
+};
+
 class ProcessMonitor {
 public:
     using LOGGER = std::function<int(std::string_view)>;
 
+    // Gets every sampled tree with the system information, time in milliseconds since the epoch, to record them into
+    // a ProcessHistory, a CompressedHistory or a RollupHistory
+    using RECORDER =
+        std::function<void(long long time, const ProcessTreeSnapshot &snapshot, const SystemInfo_T &systemInfo)>;
+
     explicit ProcessMonitor(pid_t pid, std::chrono::seconds monitorInterval = std::chrono::seconds(1), int logCount = 5)
         : pid_(pid)
         , monitorInterval_(monitorInterval)
         , logCount_(logCount) {}
 
-    ~ProcessMonitor() = default;
+    ~ProcessMonitor() {
+        stopSampling();
+    }
 
     ProcessMonitor(const ProcessMonitor &other) = delete;
     ProcessMonitor &operator=(const ProcessMonitor &other) = delete;
 
+    // Refresh every monitorInterval_ on a background thread. logTopCpu and logTopRam, and logTopThreads with
+    // sampleThreads(true), then return at once with the rankings of the last interval, only the first call waits for
+    // the first interval to complete.
+    // May be called from any thread, as stopSampling.
+    void startSampling();
+
+    void stopSampling();
+
+    // Also publish every sampled tree, with the system information, into the shared memory segment name for
+    // SharedSnapshotReader. The segment exposes the cmdlines and uids of all processes to whoever mode lets read it,
+    // only this user by default. Takes effect with the next startSampling(), an empty name stops publishing.
+    void publishSharedSnapshot(std::string name, mode_t mode = 0600) {
+        std::lock_guard<std::mutex> lock{mutex_};
+
+        sharedSnapshot_ = std::move(name);
+        sharedSnapshotMode_ = mode;
+    }
+
+    // Also update exporter with every sampled tree, which then collects I/O and file descriptors too. Takes effect
+    // with the next startSampling(), nullptr stops exporting.
+    void exportMetrics(std::shared_ptr<MetricsExporter> exporter) {
+        std::lock_guard<std::mutex> lock{mutex_};
+
+        exporter_ = std::move(exporter);
+    }
+
+    // Also hand every sampled tree to recorder, from the sampler thread, which then collects I/O and file descriptors
+    // too. The histories are not thread-safe, a recorder whose history is read from other threads locks it. Takes
+    // effect with the next startSampling(), nullptr stops recording.
+    void recordSamples(RECORDER recorder) {
+        std::lock_guard<std::mutex> lock{mutex_};
+
+        recorder_ = std::move(recorder);
+    }
+
+    // Also sample the top threads of the whole system for logTopThreads, which walks every thread on each refresh.
+    // Takes effect with the next startSampling().
+    void sampleThreads(bool enabled) {
+        std::lock_guard<std::mutex> lock{mutex_};
+
+        sampleThreads_ = enabled;
+    }
+
+    // Not to be changed while logging from another thread
+    void setReportFormat(ReportFormat format) {
+        reportFormat_ = format;
+    }
+
+    // Every report is rendered whole and handed to the logger in a single call, from a growable buffer. A sink of any
+    // callable type taking a std::string_view avoids the type erasure of LOGGER.
+    template <typename Sink>
+    void logTopCpu(Sink &&sink) const {
+        ReportBuilder report;
+
+        renderTopCpu(report);
+        sink(report.view());
+    }
+
+    template <typename Sink>
+    void logTopRam(Sink &&sink) const {
+        ReportBuilder report;
+
+        renderTopRam(report);
+        sink(report.view());
+    }
+
+    template <typename Sink>
+    void logTopThreads(Sink &&sink) const {
+        ReportBuilder report;
+
+        renderTopThreads(report);
+        sink(report.view());
+    }
+
     void logTopCpuToStdout() const {
-        logTopCpu([](std::string_view s) {
-            return ::printf("%s", s.data());
-        });
+        logTopCpu(writeToStdout);
     }
 
-    // First monitorInterval_ for top processes' CPU usages, second monitorInterval for their top threads' CPU usages.
-    // So, threads' CPU usages will delay one monitorInterval_.
-    // And total cost time is about two monitorInterval_.
-    void logTopCpu(LOGGER logger) const;
+    // Top processes' CPU usages and their top threads' CPU usages over the same monitorInterval_.
+    // So, total cost time is about one monitorInterval_, unless sampling.
+    void logTopCpu(LOGGER logger) const {
+        logTopCpu<LOGGER &>(logger);
+    }
 
     void logTopRamToStdout() const {
-        logTopRam([](std::string_view s) {
-            return ::printf("%s", s.data());
-        });
+        logTopRam(writeToStdout);
     }
 
-    void logTopRam(LOGGER logger) const;
+    void logTopRam(LOGGER logger) const {
+        logTopRam<LOGGER &>(logger);
+    }
+
+    void logTopThreadsToStdout() const {
+        logTopThreads(writeToStdout);
+    }
+
+    // Top threads' CPU usages of the whole system, whatever the monitored pid, over one monitorInterval_ unless
+    // sampling with sampleThreads(true)
+    void logTopThreads(LOGGER logger) const {
+        logTopThreads<LOGGER &>(logger);
+    }
 
 private:
-    using TopProcessThreadInfos = std::vector<TopProcessInfos>;
+    // Rankings of one monitorInterval_ published by the sampler
+    struct Sample {
+        TopProcessInfos cpu;
+        TopProcessThreadInfos cpuThreads;  // Top threads of every process in cpu, ALL_PROCESSES only
+        TopProcessInfos ram;
+        TopThreadInfos threads;  // Top threads of the whole system, if sampled
+        size_t threadsTotal;     // Threads of the whole system, 0 if not sampled
+    };
+
+    void sample();
+
+    [[nodiscard]] std::shared_ptr<const Sample> latestSample() const;
+
+    [[nodiscard]] bool sampling() const {
+        std::lock_guard<std::mutex> lock{mutex_};
+
+        return sampling_;
+    }
+
+    static int writeToStdout(std::string_view s) {
+        return static_cast<int>(std::fwrite(s.data(), 1, s.size(), stdout));
+    }
+
+    void renderTopCpu(ReportBuilder &report) const;
+
+    void renderTopCpu(ReportBuilder &report,
+                      const TopProcessInfos &topProcessInfos,
+                      const TopProcessThreadInfos &topProcessThreadInfos) const;
+
+    void renderTopRam(ReportBuilder &report) const;
+
+    void renderTopRam(ReportBuilder &report, const TopProcessInfos &topProcessInfos) const;
+
+    void renderTopThreads(ReportBuilder &report) const;
+
+    void renderTopThreads(ReportBuilder &report, const TopThreadInfos &topThreadInfos, size_t threadsTotal) const;
 
     TopProcessInfos collectTopInfo(TopInfoType type) const {
-        ProcessTreeWrapper processTreeWrapper{pid_};
+        ProcessTreeWrapper processTreeWrapper{pid_, collectFlagsOf(type)};
 
         if (type == TopInfoType::CPU) {
             std::this_thread::sleep_for(monitorInterval_);
@@ -66,6 +206,21 @@ private:
     const pid_t pid_;
     const std::chrono::seconds monitorInterval_;
     const int logCount_;
+    ReportFormat reportFormat_ = ReportFormat::TEXT;
+
+    mutable std::mutex mutex_;
+    mutable std::condition_variable cond_;
+    LatestPtr<const Sample> sample_;             // nullptr until the first interval completed, written by the sampler
+    bool sampling_ = false;                      // Guarded by mutex_
+    bool sampleThreads_ = false;                 // Guarded by mutex_
+    std::string sharedSnapshot_;                 // Guarded by mutex_
+    mode_t sharedSnapshotMode_ = 0600;           // Guarded by mutex_
+    std::shared_ptr<MetricsExporter> exporter_;  // Guarded by mutex_
+    RECORDER recorder_;                          // Guarded by mutex_
+    std::thread sampler_;
+
+    mutable std::mutex collectorMutex_;
+    mutable std::unique_ptr<ProcessCpuCollector> cpuCollector_;  // Guarded by collectorMutex_, reports without sampling
 };
 
 }  // namespace simple_process_monitor
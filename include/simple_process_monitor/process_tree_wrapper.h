@@ -4,45 +4,190 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <simple_process_monitor/ProcessTree.h>
+#include <simple_process_monitor/latest_ptr.h>
 
 namespace simple_process_monitor {
 
 enum class TopInfoType {
     CPU = 0,
-    RAM
+    RAM,
+    IO,                // Bytes read and written since the process started
+    FILE_DESCRIPTORS,  // Open file descriptors
+    THREADS
 };
 
+constexpr size_t kTopInfoTypeCount = 5;
+
+// The statistics a top list is ranked by, so the process tree skips the /proc files of everything else.
+// getTopProcessInfos() fetches the rest only for the processes it returns.
+constexpr int collectFlagsOf(TopInfoType type) {
+    switch (type) {
+        case TopInfoType::CPU:
+            return ProcessTree_CollectCpu;
+        case TopInfoType::RAM:
+            return ProcessTree_CollectMemory;
+        case TopInfoType::IO:
+            return ProcessTree_CollectIo;
+        case TopInfoType::FILE_DESCRIPTORS:
+            return ProcessTree_CollectFileDescriptors;
+        case TopInfoType::THREADS:
+            return 0;  // From the stat file which is always read
+    }
+
+    return ProcessTree_CollectAll;
+}
+
+// The statistics of all top lists, for getTopProcessInfoRankings()
+constexpr int kRankingFlags =
+    ProcessTree_CollectCpu | ProcessTree_CollectMemory | ProcessTree_CollectIo | ProcessTree_CollectFileDescriptors;
+
 struct ProcessOrThreadInfo {
     const pid_t pid;      // Can also be tid
     const int threadNum;  // Number of all threads in a process, even parsed from thread's procfs stat file
     const float cpuUsage;
     const unsigned long long ramUsage;
     const std::string cmdline;
-
-    ProcessOrThreadInfo(pid_t pid_, int threadNum_, float cpuUsage_, unsigned long long ramUsage_, std::string cmdline_)
+    const long long ioBytes;          // Read and written, 0 if not collected
+    const long long fileDescriptors;  // 0 if not collected
+
+    ProcessOrThreadInfo(pid_t pid_,
+                        int threadNum_,
+                        float cpuUsage_,
+                        unsigned long long ramUsage_,
+                        std::string cmdline_,
+                        long long ioBytes_ = 0,
+                        long long fileDescriptors_ = 0)
         : pid(pid_)
         , threadNum(threadNum_)
         , cpuUsage(cpuUsage_)
         , ramUsage(ramUsage_)
-        , cmdline(std::move(cmdline_)) {}
+        , cmdline(std::move(cmdline_))
+        , ioBytes(ioBytes_)
+        , fileDescriptors(fileDescriptors_) {}
 };
 
 using TopProcessInfos = std::vector<ProcessOrThreadInfo>;
 
+// Top lists of one snapshot, indexed by TopInfoType
+using TopProcessInfoRankings = std::array<TopProcessInfos, kTopInfoTypeCount>;
+
+// Metrics to rank processes by with TopK
+struct ProcessCpuUsage {
+    float operator()(const ProcessTree_T &p) const {
+        return p.cpu.usage.self;
+    }
+};
+
+struct ProcessRamUsage {
+    unsigned long long operator()(const ProcessTree_T &p) const {
+        return p.memory.usage;
+    }
+};
+
+struct ProcessIoBytes {
+    long long operator()(const ProcessTree_T &p) const {
+        return p.read.bytes + p.write.bytes;
+    }
+};
+
+struct ProcessFileDescriptors {
+    long long operator()(const ProcessTree_T &p) const {
+        return p.filedescriptors.usage;
+    }
+};
+
+// CPU time used since the process started, a ranking without a previous snapshot
+struct ProcessCpuTime {
+    double operator()(const ProcessTree_T &p) const {
+        return p.cpu.time;
+    }
+};
+
+struct ProcessThreads {
+    int operator()(const ProcessTree_T &p) const {
+        return p.threads.self;
+    }
+};
+
+// An immutable process tree published by ProcessTreeWrapper::update(). Its memory is pinned in the context of the
+// wrapper as long as the snapshot is referenced, or copied into the snapshot, so any thread can read it without locks
+// while the wrapper goes on refreshing.
+class ProcessTreeSnapshot {
+public:
+    // Pins the current tree of context
+    ProcessTreeSnapshot(std::shared_ptr<ProcessTree_Context> context, const ProcessTree_T *pTree, int treeSize)
+        : context_(std::move(context))
+        , pTree_(pTree)
+        , treeSize_(treeSize)
+        , pin_(ProcessTree_Context_pin(context_.get())) {}
+
+    // Copies the tree, its children and strings, nothing stays pinned
+    ProcessTreeSnapshot(const ProcessTree_T *pTree, int treeSize);
+
+    ~ProcessTreeSnapshot() {
+        if (context_) {
+            ProcessTree_Context_unpin(context_.get(), pin_);
+        }
+    }
+
+    ProcessTreeSnapshot(const ProcessTreeSnapshot &) = delete;
+    ProcessTreeSnapshot &operator=(const ProcessTreeSnapshot &) = delete;
+
+    [[nodiscard]] const ProcessTree_T *begin() const {
+        return pTree_;
+    }
+
+    [[nodiscard]] const ProcessTree_T *end() const {
+        return pTree_ + treeSize_;
+    }
+
+    [[nodiscard]] int size() const {
+        return treeSize_;
+    }
+
+    // Whether the tree is pinned in the context rather than copied
+    [[nodiscard]] bool pinned() const {
+        return context_ != nullptr;
+    }
+
+    // The cmdlines are the names from the stat files unless the tree was updated with ProcessTree_CollectCmdline, a
+    // snapshot is not modified to collect them
+    [[nodiscard]] TopProcessInfos getTopProcessInfos(TopInfoType type, int count) const;
+
+private:
+    const std::shared_ptr<ProcessTree_Context> context_;  // nullptr if copied
+    std::vector<ProcessTree_T> tree_;                     // The copy
+    std::vector<int> children_;
+    std::vector<char> strings_;
+    const ProcessTree_T *pTree_;
+    int treeSize_;
+    int pin_ = -1;
+};
+
 class ProcessTreeWrapper {
 public:
-    explicit ProcessTreeWrapper(pid_t pid)
-        : pid_(pid) {
+    // pflags is a combination of ProcessTree_Flags, workers > 1 reads /proc with a pool of that many threads
+    explicit ProcessTreeWrapper(pid_t pid, int pflags = ProcessTree_CollectAll, int workers = 1)
+        : pid_(pid)
+        , pflags_(pflags)
+        , context_(ProcessTree_Context_new(), [](ProcessTree_Context_T context) {
+            ProcessTree_Context_free(&context);
+        }) {
+        ProcessTree_Context_setWorkers(context_.get(), workers);
         update();
     }
 
+    // The context is freed with the last snapshot
     ~ProcessTreeWrapper() {
         ProcessTree_delete(&pTree_, &treeSize_);
     }
@@ -50,24 +195,52 @@ public:
     ProcessTreeWrapper(const ProcessTreeWrapper &) = delete;
     ProcessTreeWrapper &operator=(const ProcessTreeWrapper &) = delete;
 
+    // Refreshes the tree and publishes it as the latest snapshot
     void update() {
-        const int treeSize = ProcessTree_init(&pTree_, &treeSize_, static_cast<int>(pid_));
+        [[maybe_unused]] const int treeSize =
+            ProcessTree_init(&pTree_, &treeSize_, context_.get(), static_cast<int>(pid_), pflags_);
 
         if (pid_ == ALL_PROCESSES) {
             assert(treeSize >= 0);
         }
+
+        // Every snapshot kept by a reader holds an arena, the next trees are built in new ones. Past the limit the
+        // tree is copied instead, so the memory kept is that of the snapshots themselves.
+        if (ProcessTree_Context_pinned(context_.get()) < kMaxPinnedArenas) {
+            latest_.store(std::make_shared<const ProcessTreeSnapshot>(context_, pTree_, std::max(treeSize_, 0)));
+        } else {
+            latest_.store(std::make_shared<const ProcessTreeSnapshot>(pTree_, std::max(treeSize_, 0)));
+        }
     }
 
-    [[nodiscard]] TopProcessInfos getTopProcessInfos(TopInfoType type, int count) const;
+    // The tree of the last update, may be called from any thread without locking
+    [[nodiscard]] std::shared_ptr<const ProcessTreeSnapshot> latest() const {
+        return latest_.load();
+    }
+
+    // Processes (or threads) of the tree, without the virtual root
+    [[nodiscard]] std::vector<pid_t> getPids() const;
+
+    // Collects the cmdline of the returned processes if the tree was updated without it
+    [[nodiscard]] TopProcessInfos getTopProcessInfos(TopInfoType type, int count);
+
+    // Every top list in one pass over the tree, update with kRankingFlags to rank by all of them
+    [[nodiscard]] TopProcessInfoRankings getTopProcessInfoRankings(int count);
+
+    // Snapshots pinning an arena each, the following ones are copies
+    static constexpr int kMaxPinnedArenas = 4;
 
 private:
-    template <typename T>
-    TopProcessInfos getTopProcessInfos(T &maxPQ, int count) const;
+    TopProcessInfos toTopProcessInfos(const std::vector<const ProcessTree_T *> &top);
 
     const pid_t pid_;
+    const int pflags_;
 
+    std::shared_ptr<ProcessTree_Context> context_;  // Shared with the snapshots
     ProcessTree_T *pTree_ = nullptr;
     int treeSize_ = 0;
+
+    LatestPtr<const ProcessTreeSnapshot> latest_;
 };
 
 }  // namespace simple_process_monitor
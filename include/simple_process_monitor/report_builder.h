@@ -0,0 +1,34 @@
+#ifndef SIMPLE_PROCESS_MONITOR_REPORT_BUILDER_H
+#define SIMPLE_PROCESS_MONITOR_REPORT_BUILDER_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace simple_process_monitor {
+
+// Renders a whole report into one growable buffer, so a sink gets it in a single call. Lines are never truncated.
+class ReportBuilder {
+public:
+    void appendf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+    void append(std::string_view s) {
+        buffer_ += s;
+    }
+
+    // NUL-terminated, for sinks passing data() on to C functions
+    [[nodiscard]] std::string_view view() const {
+        return buffer_;
+    }
+
+    void clear() {
+        buffer_.clear();
+    }
+
+private:
+    std::string buffer_;
+};
+
+}  // namespace simple_process_monitor
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef SIMPLE_PROCESS_MONITOR_ROLLUP_HISTORY_H
+#define SIMPLE_PROCESS_MONITOR_ROLLUP_HISTORY_H
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include <simple_process_monitor/process_history.h>
+
+namespace simple_process_monitor {
+
+// The samples of one interval of a tier. A negative value is unknown, such as the CPU usage of the first sample of a
+// process, and left out of the statistics of its metric: those are -1 if no value of the metric was known.
+struct Rollup {
+    long long time;  // Start of the interval, a multiple of the resolution
+    uint32_t count;  // Samples
+    std::array<uint32_t, kHistoryMetricCount> counts;  // Known values of every metric
+    HistoryValues min;
+    HistoryValues max;
+    HistoryValues sum;
+    HistoryValues last;  // Last known value
+
+    [[nodiscard]] double average(HistoryMetric metric) const {
+        const auto i = static_cast<size_t>(metric);
+
+        return counts[i] > 0 ? sum[i] / counts[i] : -1.;
+    }
+};
+
+struct RollupTier {
+    long long resolution;  // Milliseconds
+    size_t rollups;        // Kept besides the open one, the tier spans resolution * rollups
+};
+
+// By minute for a day and by hour for four weeks
+const std::vector<RollupTier> &defaultRollupTiers();
+
+// min/max/avg/last of the samples of a process (or of the system) by interval, for every tier. A sample updates the
+// open interval of each tier, and closes it when it starts the next one. Samples must be pushed in time order.
+class RollupSeries {
+public:
+    // tiers are ordered from the finest resolution on
+    explicit RollupSeries(const std::vector<RollupTier> &tiers);
+
+    // time is in milliseconds, not before the time of the last sample
+    void push(long long time, const HistoryValues &values);
+
+    // Rollups of the intervals overlapping [from, to), oldest first, the last one may still be open. They are read
+    // from tierOf(resolution, from).
+    [[nodiscard]] std::vector<Rollup> query(long long from, long long to, long long resolution) const;
+
+    [[nodiscard]] size_t tiers() const {
+        return tiers_.size();
+    }
+
+    [[nodiscard]] long long resolution(size_t tier) const {
+        return tiers_[tier].resolution;
+    }
+
+    // The coarsest tier not coarser than resolution, or the finest tier if all are coarser. If that tier dropped the
+    // rollups of from already, the finest coarser tier which still covers from, or the coarsest tier if none does.
+    [[nodiscard]] size_t tierOf(long long resolution, long long from) const;
+
+    // Memory of the rollups
+    [[nodiscard]] size_t bytes() const;
+
+private:
+    struct Tier {
+        long long resolution;
+        size_t capacity;
+        std::deque<Rollup> closed;  // Oldest first
+        Rollup open;                // count is 0 until the first sample
+        bool dropped;               // Rollups were dropped, the tier does not reach back to the first sample
+    };
+
+    // Whether the rollups of tier reach back to time
+    [[nodiscard]] static bool covers(const Tier &tier, long long time);
+
+    std::vector<Tier> tiers_;
+};
+
+// Rollups of the processes of a process tree and of the system. Processes missing from a snapshot (or whose pid was
+// reused) are dropped with their rollups.
+// Nothing records by itself: feed it from ProcessMonitor::recordSamples(), or call record() on every refresh.
+class RollupHistory {
+public:
+    explicit RollupHistory(std::vector<RollupTier> tiers = defaultRollupTiers());
+
+    // time is in milliseconds
+    void record(long long time, const ProcessTreeSnapshot &snapshot);
+
+    void record(long long time, const SystemInfo_T &systemInfo);
+
+    // nullptr if the process is not tracked
+    [[nodiscard]] const RollupSeries *process(pid_t pid) const;
+
+    [[nodiscard]] const RollupSeries &system() const {
+        return system_;
+    }
+
+    [[nodiscard]] size_t processes() const {
+        return series_.size();
+    }
+
+    [[nodiscard]] size_t bytes() const;
+
+private:
+    const std::vector<RollupTier> tiers_;
+
+    RollupSeries system_;
+
+    TrackedProcesses<RollupSeries> series_;
+};
+
+}  // namespace simple_process_monitor
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef SIMPLE_PROCESS_MONITOR_SEGMENT_FILE_H
+#define SIMPLE_PROCESS_MONITOR_SEGMENT_FILE_H
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <simple_process_monitor/process_tree_wrapper.h>
+
+namespace simple_process_monitor {
+
+// A segment file holds process trees of consecutive refreshes, appended as blocks:
+//
+//   SegmentHeader
+//   SegmentBlock, SegmentRow[rows], string table   (one block per refresh, 8-byte aligned)
+//   ...
+//   SegmentIndexEntry[entries], SegmentFooter      (written when the segment is closed)
+//
+// Integers are in the byte order of the host. The string table holds the NUL-terminated cmdline and secattr of the
+// rows, which refer to them by offset. A segment without footer, e.g. after a crash, is read by walking the blocks
+// from the header, a block cut short by the crash is ignored.
+
+constexpr uint32_t kSegmentVersion = 1;
+
+struct SegmentHeader {
+    char magic[8];     // "SPMSEG\0\0"
+    uint32_t version;  // Readers reject other versions
+    uint32_t rowSize;  // sizeof(SegmentRow) of the writer
+    uint64_t reserved;
+};
+
+struct SegmentBlock {
+    uint32_t magic;  // kSegmentBlockMagic
+    uint32_t rows;
+    int64_t time;  // Milliseconds
+    uint32_t stringBytes;
+    uint32_t reserved;
+};
+
+constexpr uint32_t kSegmentBlockMagic = 0x4b4c4253;  // "SBLK"
+
+// A ProcessTree_T with fixed-width columns
+struct SegmentRow {
+    int32_t pid;
+    int32_t ppid;
+    int32_t parent;
+    int32_t threads;
+    int32_t threadsChildren;
+    int32_t children;  // All descendants
+    int32_t uid;
+    int32_t euid;
+    int32_t gid;
+    int32_t processor;
+    float cpuUsage;
+    float cpuUsageChildren;
+    double cpuTime;
+    uint64_t memory;
+    uint64_t memoryTotal;
+    uint64_t faultsMinor;
+    uint64_t faultsMajor;
+    int64_t priority;
+    int64_t nice;
+    int64_t readBytes;
+    int64_t readOperations;
+    int64_t writeBytes;
+    int64_t writeOperations;
+    int64_t fileDescriptors;
+    int64_t fileDescriptorsTotal;
+    int64_t uptime;
+    uint32_t cmdline;  // Offset in the string table, kSegmentNoString if none
+    uint32_t secattr;
+    uint8_t zombie;
+    uint8_t reserved[7];
+};
+
+static_assert(sizeof(SegmentHeader) == 24 && sizeof(SegmentBlock) == 24 && sizeof(SegmentRow) == 176,
+              "The segment format must not depend on the compiler");
+
+constexpr uint32_t kSegmentNoString = UINT32_MAX;
+
+struct SegmentIndexEntry {
+    int64_t time;
+    uint64_t offset;  // Of the SegmentBlock
+};
+
+struct SegmentFooter {
+    uint64_t index;  // Offset of the first SegmentIndexEntry
+    uint32_t entries;
+    uint32_t magic;  // kSegmentFooterMagic
+};
+
+constexpr uint32_t kSegmentFooterMagic = 0x5446504d;  // "MPFT"
+
+// Appends refreshes to a segment file. Opening an existing segment continues it: its footer is cut off, or after a
+// crash the blocks are walked and a partially written one is cut off.
+class SegmentWriter {
+public:
+    SegmentWriter() = default;
+
+    ~SegmentWriter() {
+        close();
+    }
+
+    SegmentWriter(const SegmentWriter &) = delete;
+    SegmentWriter &operator=(const SegmentWriter &) = delete;
+
+    // false with errno set if the file cannot be opened or is not a segment of this version
+    bool open(const std::string &path);
+
+    // time is in milliseconds, not before the time of the last block. A failed write is cut off the file, if that
+    // fails too every later append fails with EIO until the segment is opened again.
+    bool append(long long time, const ProcessTreeSnapshot &snapshot);
+
+    // Writes the index and the footer, unless an append left the file in a failed state
+    bool close();
+
+    [[nodiscard]] size_t blocks() const {
+        return index_.size();
+    }
+
+private:
+    int fd_ = -1;
+    bool failed_ = false;  // A failed block could not be cut off
+    uint64_t size_ = 0;
+    std::vector<SegmentIndexEntry> index_;
+    std::vector<char> buffer_;   // Block being appended, reused
+    std::vector<char> strings_;  // Its string table
+};
+
+// Maps a segment file read-only and iterates its rows in place
+class SegmentReader {
+public:
+    SegmentReader() = default;
+
+    ~SegmentReader() {
+        close();
+    }
+
+    SegmentReader(const SegmentReader &) = delete;
+    SegmentReader &operator=(const SegmentReader &) = delete;
+
+    // false with errno set if the file cannot be mapped, is not a segment of this version, or its index does not
+    // point to complete blocks in order
+    bool open(const std::string &path);
+
+    void close();
+
+    [[nodiscard]] size_t blocks() const {
+        return index_.size();
+    }
+
+    [[nodiscard]] long long time(size_t block) const {
+        return index_[block].time;
+    }
+
+    // The rows of a block, in the mapped file
+    [[nodiscard]] const SegmentRow *rows(size_t block, size_t *count) const;
+
+    // A string of a row of a block, nullptr if none
+    [[nodiscard]] const char *string(size_t block, uint32_t offset) const;
+
+    // The last block at or before time, blocks() if there is none
+    [[nodiscard]] size_t find(long long time) const;
+
+private:
+    [[nodiscard]] const SegmentBlock *block(size_t block) const {
+        return reinterpret_cast<const SegmentBlock *>(data_ + index_[block].offset);
+    }
+
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<SegmentIndexEntry> index_;
+};
+
+}  // namespace simple_process_monitor
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef SIMPLE_PROCESS_MONITOR_SHARED_SNAPSHOT_H
+#define SIMPLE_PROCESS_MONITOR_SHARED_SNAPSHOT_H
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <simple_process_monitor/process_tree_wrapper.h>
+#include <simple_process_monitor/system_info.h>
+
+namespace simple_process_monitor {
+
+// A POSIX shared memory segment holding the last published snapshot, so other processes of the host read it instead
+// of scanning /proc themselves:
+//
+//   SharedSnapshotHeader
+//   SharedProcess[capacity]
+//
+// The publisher brackets every update with a seqlock: sequence is odd while the payload is written. A reader copies
+// the payload and retries if sequence was odd or changed meanwhile, so it neither blocks the publisher nor makes a
+// system call. Both sides must be built for the same ABI, which the header records.
+
+constexpr uint32_t kSharedSnapshotVersion = 1;
+
+// A summary of a ProcessTree_T
+struct SharedProcess {
+    int32_t pid;
+    int32_t ppid;
+    int32_t threads;
+    int32_t uid;
+    float cpuUsage;  // [%], -1 if unknown
+    int32_t reserved;
+    uint64_t memory;
+    int64_t ioBytes;  // Read and written, 0 if not collected
+    int64_t fileDescriptors;
+    int64_t uptime;
+    char cmdline[80];  // Truncated, empty if not collected
+};
+
+struct SharedSnapshotHeader {
+    char magic[8];  // "SPMSHM\0\0"
+    uint32_t version;
+    uint32_t headerSize;   // sizeof(SharedSnapshotHeader) of the publisher
+    uint32_t processSize;  // sizeof(SharedProcess) of the publisher
+    uint32_t capacity;     // Of processes
+    std::atomic<uint32_t> sequence;
+
+    // The payload, consistent only as read between two equal even sequences
+    uint32_t processes;  // Published, at most capacity
+    uint32_t total;      // Processes of the tree, more than processes if it did not fit
+    int64_t time;        // Milliseconds since the epoch, 0 until the first snapshot
+    SystemInfo_T system;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "The seqlock is shared between processes");
+
+// A copy of the payload
+struct SharedSnapshot {
+    long long time = 0;
+    size_t total = 0;
+    SystemInfo_T system{};
+    std::vector<SharedProcess> processes;
+};
+
+// Publishes snapshots into a shared memory segment. The segment outlives the publisher, readers keep their mapping
+// when the monitor restarts, and a restarted publisher takes over a segment of the same layout.
+class SharedSnapshotPublisher {
+public:
+    static constexpr size_t kDefaultCapacity = 16384;
+
+    SharedSnapshotPublisher() = default;
+
+    ~SharedSnapshotPublisher() {
+        close();
+    }
+
+    SharedSnapshotPublisher(const SharedSnapshotPublisher &) = delete;
+    SharedSnapshotPublisher &operator=(const SharedSnapshotPublisher &) = delete;
+
+    // name is a shm_open() name such as "/simple_process_monitor", false with errno set on failure. The segment holds
+    // the cmdlines and uids of the processes, it gets mode whether created or taken over: only the owner reads it by
+    // default, 0644 shares it with every user of the host.
+    bool open(const std::string &name, size_t capacity = kDefaultCapacity, mode_t mode = 0600);
+
+    void close();
+
+    // Processes beyond the capacity are left out, in tree order
+    void publish(long long time, const ProcessTreeSnapshot &snapshot, const SystemInfo_T &systemInfo);
+
+    // Deletes the segment, mapped readers keep their memory
+    static bool remove(const std::string &name);
+
+private:
+    SharedSnapshotHeader *header_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Maps a published segment read-only
+class SharedSnapshotReader {
+public:
+    SharedSnapshotReader() = default;
+
+    ~SharedSnapshotReader() {
+        close();
+    }
+
+    SharedSnapshotReader(const SharedSnapshotReader &) = delete;
+    SharedSnapshotReader &operator=(const SharedSnapshotReader &) = delete;
+
+    // false with errno set if there is no segment or it has another layout
+    bool open(const std::string &name);
+
+    void close();
+
+    // Copies the last snapshot into snapshot, reusing its memory. false if none was published yet, or if the publisher
+    // died while updating it.
+    bool read(SharedSnapshot &snapshot) const;
+
+private:
+    const SharedSnapshotHeader *header_ = nullptr;
+    size_t size_ = 0;
+};
+
+}  // namespace simple_process_monitor
+
+#endif
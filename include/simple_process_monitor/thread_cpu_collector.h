@@ -0,0 +1,76 @@
+#ifndef SIMPLE_PROCESS_MONITOR_THREAD_CPU_COLLECTOR_H
+#define SIMPLE_PROCESS_MONITOR_THREAD_CPU_COLLECTOR_H
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace simple_process_monitor {
+
+struct ThreadInfo {
+    const pid_t tid;
+    const pid_t pid;  // Process owning the thread
+    const float cpuUsage;
+    const std::string comm;  // Name of the thread, from its procfs stat file
+
+    ThreadInfo(pid_t tid_, pid_t pid_, float cpuUsage_, std::string comm_)
+        : tid(tid_)
+        , pid(pid_)
+        , cpuUsage(cpuUsage_)
+        , comm(std::move(comm_)) {}
+};
+
+using TopThreadInfos = std::vector<ThreadInfo>;
+
+// CPU usages of all threads of the system, to find a hot thread whatever the rank of its process. Every update walks
+// /proc/*/task/* once and keeps a few numbers per thread, the CPU time of the previous update to compute the usage
+// from. Names are only read for the threads of a top list.
+//
+// Not thread-safe: update and getTopThreadInfos both read through the same cache of open stat files.
+class ThreadCpuCollector {
+public:
+    // At most maxOpenFiles stat files of threads are kept open from one update to the next, -1 for no limit but the
+    // process wide budget of half of RLIMIT_NOFILE, 0 to open every file on each read
+    explicit ThreadCpuCollector(int maxOpenFiles = -1);
+    ~ThreadCpuCollector();
+
+    ThreadCpuCollector(const ThreadCpuCollector &) = delete;
+    ThreadCpuCollector &operator=(const ThreadCpuCollector &) = delete;
+
+    void update();
+
+    // Number of threads found by the last update
+    [[nodiscard]] size_t size() const {
+        return threads_.size();
+    }
+
+    // Of the last update, empty after the first one which has no CPU usages yet. Reads the names of the top threads
+    // through the cache of stat files, so it must not run concurrently with update.
+    [[nodiscard]] TopThreadInfos getTopThreadInfos(int count);
+
+    // Per thread state of one update
+    struct Thread {
+        pid_t tid;
+        pid_t pid;
+        unsigned long long starttime;  // Tells a reused tid apart
+        double time;                   // CPU time
+        float usage;                   // -1 if unknown
+    };
+
+private:
+    struct Context;
+
+    std::unique_ptr<Context> context_;
+
+    std::vector<Thread> threads_;
+    std::vector<Thread> previous_;
+    unsigned long long time_ = 0;
+};
+
+}  // namespace simple_process_monitor
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef SIMPLE_PROCESS_MONITOR_TOP_K_H
+#define SIMPLE_PROCESS_MONITOR_TOP_K_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace simple_process_monitor {
+
+// Selects the k elements with the largest Metric in one pass, keeping only those k in a min-heap: O(n log k) time and
+// O(k) memory instead of sorting or heapifying all n elements. Metric is a stateless functor chosen at compile time,
+// Metric{}(element) returns the value to rank by. Equal values rank the element pushed first higher.
+template <typename T, typename Metric>
+class TopK {
+public:
+    using Value = std::decay_t<decltype(Metric{}(std::declval<const T &>()))>;
+
+    // The heap grows with the elements pushed, k may exceed their number
+    explicit TopK(size_t k)
+        : k_(k) {}
+
+    void push(const T &element) {
+        if (k_ == 0) {
+            return;
+        }
+
+        const Value value = Metric{}(element);
+        const size_t serial = serial_++;
+
+        if (heap_.size() < k_) {
+            heap_.push_back(Entry{value, serial, &element});
+            std::push_heap(heap_.begin(), heap_.end(), better);
+        } else if (value > heap_.front().value) {
+            // Replace the lowest ranked element, an equal value was pushed later so it ranks lower
+            std::pop_heap(heap_.begin(), heap_.end(), better);
+            heap_.back() = Entry{value, serial, &element};
+            std::push_heap(heap_.begin(), heap_.end(), better);
+        }
+    }
+
+    [[nodiscard]] size_t size() const {
+        return heap_.size();
+    }
+
+    // The selected elements, highest ranked first. The selection is consumed.
+    [[nodiscard]] std::vector<const T *> take() {
+        std::sort_heap(heap_.begin(), heap_.end(), better);
+
+        std::vector<const T *> ret;
+        ret.reserve(heap_.size());
+
+        for (const Entry &entry : heap_) {
+            ret.push_back(entry.element);
+        }
+
+        heap_.clear();
+
+        return ret;
+    }
+
+private:
+    struct Entry {
+        Value value;
+        size_t serial;
+        const T *element;
+    };
+
+    // Ranks a before b. As the heap's "less than" it keeps the lowest ranked element at the front.
+    static bool better(const Entry &a, const Entry &b) {
+        return a.value > b.value || (!(b.value > a.value) && a.serial < b.serial);
+    }
+
+    const size_t k_;
+    size_t serial_ = 0;
+    std::vector<Entry> heap_;
+};
+
+// Top k elements of [first, last) by Metric which satisfy pred, highest ranked first
+template <typename Metric, typename Iterator, typename Pred>
+auto topK(Iterator first, Iterator last, size_t k, Pred pred) {
+    TopK<std::decay_t<decltype(*first)>, Metric> top{std::min(k, static_cast<size_t>(std::distance(first, last)))};
+
+    for (; first != last; ++first) {
+        if (pred(*first)) {
+            top.push(*first);
+        }
+    }
+
+    return top.take();
+}
+
+}  // namespace simple_process_monitor
+
+#endif
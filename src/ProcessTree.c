@@ -25,17 +25,22 @@
 #include <simple_process_monitor/ProcessTree.h>
 
 #include <assert.h>
-#include <dirent.h>
-#include <glob.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/sysinfo.h>
 
+#include "util/Arena.h"
 #include "util/Mem.h"
+#include "util/PidIndex.h"
+#include "util/ProcCache.h"
+#include "util/ProcDir.h"
+#include "util/ProcStat.h"
 #include "util/Str.h"
 #include "util/StringBuffer.h"
+#include "util/WorkerPool.h"
 #include "util/debug.h"
 #include "util/file.h"
 #include "util/time.h"
@@ -50,6 +55,27 @@
 
 /* ------------------------------------------------------------- Definitions */
 
+struct ProcessTree_Context {
+    PidIndex_T index;      // pid -> entry of the current process tree
+    PidIndex_T spare;      // Swapped with index on every refresh, keeps the old tree searchable while building the new
+    ProcCache_T files;     // Open /proc files of the processes in the tree
+    WorkerPool_T workers;  // Threads reading /proc, NULL if it is read on the calling thread
+    ProcDir_T directory;   // Enumerates the processes (or threads) in /proc
+    int pid;               // Process the tree was last initialized for, or ALL_PROCESSES
+    struct {
+        Arena_T arena;
+        int pins;  // Readers of the tree in this arena, see ProcessTree_Context_pin()
+    } *arenas;     // Memory of the trees, the previous tree stays valid while the next one is built
+    int arenaCount;
+    int arena;              // Index of the arena of the current tree
+    pthread_mutex_t mutex;  // Guards the pins, which are released from any thread
+};
+
+// Room for parents which are not in /proc, on Linux there is usually one: pid 0 of init and kthreadd
+#define VIRTUAL_PARENTS 8
+
+_Static_assert(PROCESS_TREE_COMM_LEN == PROC_STAT_COMM_LEN, "the tree keeps the whole name parsed from stat");
+
 /* ----------------------------------------------------------------- Private */
 
 /**
@@ -64,97 +90,204 @@ static time_t _getStartTime(void) {
     return Time_now() - info.uptime;
 }
 
+// The memory of the tree belongs to an arena of its context, it is reused by the next tree
+// An arena which holds neither the current tree nor a pinned one, a new one if all are in use
+static int _nextArena(ProcessTree_Context_T context) {
+    pthread_mutex_lock(&context->mutex);
+    int next = -1;
+    for (int i = 0; i < context->arenaCount && next == -1; i++) {
+        if (i != context->arena && context->arenas[i].pins == 0)
+            next = i;
+    }
+    if (next == -1) {
+        RESIZE(context->arenas, (long)sizeof(*context->arenas) * (context->arenaCount + 1));
+        next = context->arenaCount++;
+        context->arenas[next].arena = Arena_new(0);
+        context->arenas[next].pins = 0;
+    }
+    pthread_mutex_unlock(&context->mutex);
+    return next;
+}
+
 static void _delete(ProcessTree_T **pt, int *size) {
     assert(pt);
-    ProcessTree_T *_pt = *pt;
-    if (_pt) {
-        for (int i = 0; i < *size; i++) {
-            FREE(_pt[i].cmdline);
-            FREE(_pt[i].children.list);
-            FREE(_pt[i].secattr);
-        }
-        FREE(_pt);
-        *pt = NULL;
-        *size = 0;
-    }
+    *pt = NULL;
+    *size = 0;
 }
 
 /**
- * Search a leaf in the processtree
- * @param pid  pid of the process
- * @param pt  processtree
- * @param treesize  size of the processtree
- * @return process index if succeeded otherwise -1
+ * Link the children of every process in one array, in compressed sparse row form: the children of a process are a
+ * contiguous range of the array which children.list points to, in the order of the process tree
+ * @param pt process tree with the parent of every process set
+ * @param size process tree size
+ * @param arena memory of the process tree
  */
-static int _findProcess(int pid, ProcessTree_T *pt, int size) {
-    if (size > 0) {
-        for (int i = 0; i < size; i++)
-            if (pid == pt[i].pid)
-                return i;
+static void _linkChildren(ProcessTree_T *pt, int size, Arena_T arena) {
+    int edges = 0;
+    for (int i = 0; i < size; i++) {
+        if (pt[i].parent != -1 && pt[i].parent != i) {
+            pt[pt[i].parent].children.count++;
+            edges++;
+        }
+    }
+    int *children = edges ? Arena_alloc(arena, (long)sizeof(int) * edges) : NULL;
+    for (int i = 0, offset = 0; i < size; i++) {
+        pt[i].children.list = pt[i].children.count ? &children[offset] : NULL;
+        offset += pt[i].children.count;
+        pt[i].children.count = 0;
+    }
+    for (int i = 0; i < size; i++) {
+        if (pt[i].parent != -1 && pt[i].parent != i) {
+            ProcessTree_T *parent_pt = &pt[pt[i].parent];
+            parent_pt->children.list[parent_pt->children.count++] = i;
+        }
     }
-    return -1;
 }
 
 /**
- * Fill data in the process tree by recursively walking through it
+ * Fill data in the process tree by walking through it. The processes are visited in breadth-first order from the root
+ * and summed up in the reverse order, so every process is done before its parent without recursion.
  * @param pt process tree
- * @param i process index
+ * @param size process tree size
+ * @param index root process index
+ * @param arena memory of the process tree
  */
-static void _fillProcessTree(ProcessTree_T *pt, int index) {
-    if (!pt[index].visited) {
-        pt[index].visited = true;
-        pt[index].children.total = pt[index].children.count;
-        pt[index].threads.children = 0;
-        pt[index].cpu.usage.children = 0.;
-        pt[index].memory.usage_total = pt[index].memory.usage;
-        pt[index].filedescriptors.usage_total = pt[index].filedescriptors.usage;
-        for (int i = 0; i < pt[index].children.count; i++) {
-            _fillProcessTree(pt, pt[index].children.list[i]);
+static void _fillProcessTree(ProcessTree_T *pt, int size, int index, Arena_T arena) {
+    int *order = Arena_alloc(arena, (long)sizeof(int) * size);
+    int count = 0;
+    order[count++] = index;
+    pt[index].visited = true;
+    for (int i = 0; i < count; i++) {
+        ProcessTree_T *p = &pt[order[i]];
+        p->children.total = p->children.count;
+        p->threads.children = 0;
+        p->cpu.usage.children = 0.;
+        p->memory.usage_total = p->memory.usage;
+        p->filedescriptors.usage_total = p->filedescriptors.usage;
+        for (int j = 0; j < p->children.count; j++) {
+            int child = p->children.list[j];
+            if (!pt[child].visited) {
+                pt[child].visited = true;
+                order[count++] = child;
+            }
         }
-        if (pt[index].parent != -1 && pt[index].parent != index) {
-            ProcessTree_T *parent_pt = &pt[pt[index].parent];
-            parent_pt->children.total += pt[index].children.total;
-            parent_pt->threads.children += (pt[index].threads.self > 1 ? pt[index].threads.self : 1) +
-                                           (pt[index].threads.children > 0 ? pt[index].threads.children : 0);
-            if (pt[index].cpu.usage.self >= 0) {
-                parent_pt->cpu.usage.children += pt[index].cpu.usage.self;
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        int current = order[i];
+        if (pt[current].parent != -1 && pt[current].parent != current) {
+            ProcessTree_T *parent_pt = &pt[pt[current].parent];
+            parent_pt->children.total += pt[current].children.total;
+            parent_pt->threads.children += (pt[current].threads.self > 1 ? pt[current].threads.self : 1) +
+                                           (pt[current].threads.children > 0 ? pt[current].threads.children : 0);
+            if (pt[current].cpu.usage.self >= 0) {
+                parent_pt->cpu.usage.children += pt[current].cpu.usage.self;
             }
-            if (pt[index].cpu.usage.children >= 0) {
-                parent_pt->cpu.usage.children += pt[index].cpu.usage.children;
+            if (pt[current].cpu.usage.children >= 0) {
+                parent_pt->cpu.usage.children += pt[current].cpu.usage.children;
             }
-            parent_pt->memory.usage_total += pt[index].memory.usage_total;
-            parent_pt->filedescriptors.usage_total += pt[index].filedescriptors.usage_total;
+            parent_pt->memory.usage_total += pt[current].memory.usage_total;
+            parent_pt->filedescriptors.usage_total += pt[current].filedescriptors.usage_total;
         }
     }
 }
 
-static int _initprocesstree_sysdep(ProcessTree_T **reference, int pid);
+static int _initprocesstree_sysdep(
+    ProcessTree_T **reference, int *capacity, ProcessTree_Context_T context, int pid, int pflags);
 
 /* ------------------------------------------------------------------ Public */
 
+ProcessTree_Context_T ProcessTree_Context_new(void) {
+    ProcessTree_Context_T context;
+    NEW(context);
+    context->index = PidIndex_new(0);
+    context->spare = PidIndex_new(0);
+    context->files = ProcCache_new(-1);
+    context->directory = ProcDir_new();
+    context->arenaCount = 2;
+    context->arenas = CALLOC(sizeof(*context->arenas), context->arenaCount);
+    for (int i = 0; i < context->arenaCount; i++)
+        context->arenas[i].arena = Arena_new(0);
+    pthread_mutex_init(&context->mutex, NULL);
+    return context;
+}
+
+void ProcessTree_Context_free(ProcessTree_Context_T *pContext) {
+    assert(pContext && *pContext);
+    PidIndex_free(&(*pContext)->index);
+    PidIndex_free(&(*pContext)->spare);
+    ProcCache_free(&(*pContext)->files);
+    ProcDir_free(&(*pContext)->directory);
+    for (int i = 0; i < (*pContext)->arenaCount; i++) {
+        assert((*pContext)->arenas[i].pins == 0);
+        Arena_free(&(*pContext)->arenas[i].arena);
+    }
+    FREE((*pContext)->arenas);
+    pthread_mutex_destroy(&(*pContext)->mutex);
+    if ((*pContext)->workers)
+        WorkerPool_free(&(*pContext)->workers);
+    FREE(*pContext);
+}
+
+void ProcessTree_Context_setWorkers(ProcessTree_Context_T context, int workers) {
+    assert(context);
+    assert(workers > 0);
+    if (context->workers) {
+        if (WorkerPool_workers(context->workers) == workers)
+            return;
+        WorkerPool_free(&context->workers);
+    }
+    if (workers > 1)
+        context->workers = WorkerPool_new(workers);
+}
+
+int ProcessTree_Context_pin(ProcessTree_Context_T context) {
+    assert(context);
+    pthread_mutex_lock(&context->mutex);
+    context->arenas[context->arena].pins++;
+    pthread_mutex_unlock(&context->mutex);
+    return context->arena;
+}
+
+void ProcessTree_Context_unpin(ProcessTree_Context_T context, int pin) {
+    assert(context);
+    pthread_mutex_lock(&context->mutex);
+    assert(pin >= 0 && pin < context->arenaCount && context->arenas[pin].pins > 0);
+    context->arenas[pin].pins--;
+    pthread_mutex_unlock(&context->mutex);
+}
+
+int ProcessTree_Context_pinned(ProcessTree_Context_T context) {
+    assert(context);
+    int pinned = 0;
+    pthread_mutex_lock(&context->mutex);
+    for (int i = 0; i < context->arenaCount; i++) {
+        if (context->arenas[i].pins > 0)
+            pinned++;
+    }
+    pthread_mutex_unlock(&context->mutex);
+    return pinned;
+}
+
 /**
  * Initialize the process tree
  * @return treesize >= 0 if succeeded otherwise < 0
  */
-int ProcessTree_init(ProcessTree_T **ppTree, int *pTreeSize, int pid) {
+int ProcessTree_init(ProcessTree_T **ppTree, int *pTreeSize, ProcessTree_Context_T context, int pid, int pflags) {
+    assert(context);
+    // We need only process's cpu.time from the old ptree. It stays in its arena while the new ptree is built in
+    // another one, whose memory (of the ptree before the old one, unless pinned) is reused.
     ProcessTree_T *oldptree = *ppTree;
-    int oldptreesize = *pTreeSize;
-    if (oldptree) {
-        *ppTree = NULL;
-        *pTreeSize = 0;
-        // We need only process's cpu.time from the old ptree, so free dynamically allocated parts which we don't need
-        // before initializing new ptree (so the memory can be reused, otherwise the memory footprint will hold two
-        // ptrees)
-        for (int i = 0; i < oldptreesize; i++) {
-            FREE(oldptree[i].cmdline);
-            FREE(oldptree[i].children.list);
-            FREE(oldptree[i].secattr);
-        }
-    }
+    *ppTree = NULL;
+    *pTreeSize = 0;
+    context->arena = _nextArena(context);
+    Arena_clear(context->arenas[context->arena].arena);
 
     double time_prev = oldptree ? oldptree->time : 0.;
 
-    if ((*pTreeSize = _initprocesstree_sysdep(ppTree, pid)) <= 0 || !(*ppTree)) {
+    context->pid = pid;
+
+    int capacity;
+    if ((*pTreeSize = _initprocesstree_sysdep(ppTree, &capacity, context, pid, pflags)) <= 0 || !(*ppTree)) {
         DEBUG("System statistic -- cannot initialize the process tree -- process resource monitoring disabled\n");
         if (oldptree)
             _delete(ppTree, pTreeSize);
@@ -170,10 +303,19 @@ int ProcessTree_init(ProcessTree_T **ppTree, int *pTreeSize, int pid) {
 
     double time_delta = pt->time - time_prev;
 
+    // The index of the old tree is kept in context->index, build the new one in the spare table
+    PidIndex_T oldindex = context->index;
+    PidIndex_T index = context->spare;
+    PidIndex_clear(index, *pTreeSize);
+    for (int i = 0; i < *pTreeSize; i++)
+        PidIndex_put(index, pt[i].pid, i);
+    context->index = index;
+    context->spare = oldindex;
+
     for (int i = 0; i < (volatile int)*pTreeSize; i++) {
         pt[i].cpu.usage.self = -1;
         if (oldptree) {
-            int oldentry = _findProcess(pt[i].pid, oldptree, oldptreesize);
+            int oldentry = PidIndex_get(oldindex, pt[i].pid);
             if (oldentry != -1) {
                 if (g_fixed_system_info.cpu_count > 0 && time_delta > 0 && oldptree[oldentry].cpu.time >= 0 &&
                     pt[i].cpu.time >= oldptree[oldentry].cpu.time) {
@@ -192,25 +334,27 @@ int ProcessTree_init(ProcessTree_T **ppTree, int *pTreeSize, int pid) {
         } else {
             // Find this process's parent when not creating thread tree
             if (pid == ALL_PROCESSES) {
-                int parent = _findProcess(pt[i].ppid, pt, *pTreeSize);
+                int parent = PidIndex_get(index, pt[i].ppid);
                 if (parent == -1) {
                     /* Parent process wasn't found - on Linux this is normal: main process with PID 0 is not listed,
                      * similarly in FreeBSD jail. We create virtual process entry for missing parent so we can have full
                      * tree-like structure with root. */
+                    if (*pTreeSize == capacity) {
+                        capacity += VIRTUAL_PARENTS;
+                        pt = *ppTree = Arena_resize(context->arenas[context->arena].arena,
+                                                    pt,
+                                                    (long)sizeof(ProcessTree_T) * *pTreeSize,
+                                                    (long)sizeof(ProcessTree_T) * capacity);
+                    }
                     parent = (*pTreeSize)++;
-                    pt = RESIZE(*ppTree, (*pTreeSize) * sizeof(ProcessTree_T));
                     memset(&pt[parent], 0, sizeof(ProcessTree_T));
                     root = pt[parent].ppid = pt[parent].pid = pt[i].ppid;
+                    PidIndex_put(index, pt[parent].pid, parent);
                 }
                 pt[i].parent = parent;
-                // Connect the child (this process) to the parent
-                RESIZE(pt[parent].children.list, sizeof(int) * (pt[parent].children.count + 1));
-                pt[parent].children.list[pt[parent].children.count] = i;
-                pt[parent].children.count++;
             }
         }
     }
-    FREE(oldptree);  // Free the rest of old ptree
 
     if (pid == ALL_PROCESSES) {
         if (root == -1) {
@@ -219,12 +363,42 @@ int ProcessTree_init(ProcessTree_T **ppTree, int *pTreeSize, int pid) {
             return -1;
         }
 
-        _fillProcessTree(pt, root);
+        // Connect the children to their parents
+        _linkChildren(pt, *pTreeSize, context->arenas[context->arena].arena);
+        _fillProcessTree(pt, *pTreeSize, root, context->arenas[context->arena].arena);
     }
 
     return *pTreeSize;
 }
 
+int ProcessTree_children(
+    const ProcessTree_T *pTree, __attribute__((unused)) int treeSize, int index, const int **pChildren) {
+    assert(pTree);
+    assert(pChildren);
+    assert(index >= 0 && index < treeSize);
+    *pChildren = pTree[index].children.list;
+    return pTree[index].children.count;
+}
+
+int ProcessTree_descendants(
+    const ProcessTree_T *pTree, __attribute__((unused)) int treeSize, int index, int *descendants, int size) {
+    assert(pTree);
+    assert(descendants || size == 0);
+    assert(index >= 0 && index < treeSize);
+    // The buffer is the queue of the breadth-first walk
+    int count = 0;
+    for (int current = index, next = 0;; current = descendants[next++]) {
+        const ProcessTree_T *p = &pTree[current];
+        if (count + p->children.count > size)
+            return -1;
+        if (p->children.count)
+            memcpy(&descendants[count], p->children.list, sizeof(int) * p->children.count);
+        count += p->children.count;
+        if (next == count)
+            return count;
+    }
+}
+
 /**
  * Delete the process tree
  */
@@ -246,22 +420,17 @@ static struct {
 
 typedef struct Proc_T {
     StringBuffer_T name;
+    ProcCache_T files;
+    ProcCache_Entry_T *file;
+    Arena_T arena;  // Memory of the process tree
 
     struct {
         int pid;
         int tid;
-        int ppid;
         int uid;
         int euid;
         int gid;
-        char item_state;
-        long item_cutime;
-        long item_cstime;
-        long item_rss;
-        int item_threads;
-        unsigned long item_utime;
-        unsigned long item_stime;
-        unsigned long long item_starttime;
+        ProcStat_T stat;
 
         struct {
             unsigned long long bytes;
@@ -300,31 +469,15 @@ static void __attribute__((constructor)) _constructor(void) {
 // parse /proc/PID/stat or /proc/PID/task/TID/stat
 static bool _parseProcPidStat(Proc_T proc) {
     char buf[8192];
-    char *tmp = NULL;
-    if (!file_readProc(buf, sizeof(buf), "stat", proc->data.pid, proc->data.tid, NULL)) {
+    if (!ProcCache_read(proc->files, proc->file, ProcFile_Stat, buf, sizeof(buf), NULL)) {
         DEBUG("system statistic error -- cannot read /proc/%d/stat\n", proc->data.pid);
         return false;
     }
-    // Skip the process name (can have multiple words)
-    if (!(tmp = strrchr(buf, ')'))) {
-        DEBUG("system statistic error -- file /proc/%d/stat parse error\n", proc->data.pid);
-        return false;
-    }
-    if (sscanf(tmp + 2,
-               "%c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld %*d %*d %d %*u %llu %*u %ld %*u %*u %*u %*u "
-               "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %*d\n",
-               &(proc->data.item_state),
-               &(proc->data.ppid),
-               &(proc->data.item_utime),
-               &(proc->data.item_stime),
-               &(proc->data.item_cutime),
-               &(proc->data.item_cstime),
-               &(proc->data.item_threads),
-               &(proc->data.item_starttime),
-               &(proc->data.item_rss)) != 9) {
+    if (!ProcStat_parse(buf, &(proc->data.stat))) {
         DEBUG("system statistic error -- file /proc/%d/stat parse error\n", proc->data.pid);
         return false;
     }
+    ProcCache_validate(proc->files, proc->file, proc->data.stat.starttime);
     return true;
 }
 
@@ -332,7 +485,7 @@ static bool _parseProcPidStat(Proc_T proc) {
 static bool _parseProcPidStatus(Proc_T proc) {
     char buf[4096];
     char *tmp = NULL;
-    if (!file_readProc(buf, sizeof(buf), "status", proc->data.pid, proc->data.tid, NULL)) {
+    if (!ProcCache_read(proc->files, proc->file, ProcFile_Status, buf, sizeof(buf), NULL)) {
         DEBUG("system statistic error -- cannot read /proc/%d/status\n", proc->data.pid);
         return false;
     }
@@ -360,7 +513,7 @@ static bool _parseProcPidIO(Proc_T proc) {
     char buf[4096];
     char *tmp = NULL;
     if (_statistics.hasIOStatistics) {
-        if (file_readProc(buf, sizeof(buf), "io", proc->data.pid, proc->data.tid, NULL)) {
+        if (ProcCache_read(proc->files, proc->file, ProcFile_Io, buf, sizeof(buf), NULL)) {
             // read bytes (total)
             if (!(tmp = strstr(buf, "rchar:"))) {
                 DEBUG("system statistic error -- cannot find process read bytes\n");
@@ -416,7 +569,7 @@ static bool _parseProcPidIO(Proc_T proc) {
                 return false;
             }
         } else {
-            // file_readProc() already printed a DEBUG() message
+            // ProcCache_read() already printed a DEBUG() message
             // return false;
             // sometimes no io data is available, this is not a problem.
             return true;
@@ -427,67 +580,48 @@ static bool _parseProcPidIO(Proc_T proc) {
 
 // parse /proc/PID/cmdline or /proc/PID/task/TID/stat
 static bool _parseProcPidCmdline(Proc_T proc) {
+    // The command line rarely changes, it is read once per process and again only if the process called exec which
+    // changed its name
+    int key = Str_hash(proc->data.stat.comm);
     if (proc->data.tid == -1) {
-        char filename[STRLEN];
-        // Try to collect the command-line from the procfs cmdline (user-space processes)
-        snprintf(filename, sizeof(filename), "/proc/%d/cmdline", proc->data.pid);
-        FILE *f = fopen(filename, "r");
-        if (!f) {
-            DEBUG("system statistic error -- cannot open /proc/%d/cmdline: %s\n", proc->data.pid, STRERROR);
-            return false;
+        const char *cmdline = ProcCache_cmdline(proc->files, proc->file, key);
+        if (cmdline) {
+            StringBuffer_append(proc->name, "%s", cmdline);
+            return true;
         }
-        size_t n;
-        char buf[STRLEN] = {};
-        while ((n = fread(buf, 1, sizeof(buf) - 1, f)) > 0) {
+        // Try to collect the command-line from the procfs cmdline (user-space processes)
+        int n;
+        long offset = 0;
+        char buf[4096];
+        while ((n = ProcCache_pread(proc->files, proc->file, ProcFile_Cmdline, buf, sizeof(buf), offset)) > 0) {
             // The cmdline file contains argv elements/strings separated by '\0' => join the string
-            for (size_t i = 0; i < n; i++) {
-                if (buf[i] == 0)
-                    StringBuffer_append(proc->name, " ");
-                else
-                    StringBuffer_append(proc->name, "%c", buf[i]);
-            }
-        }
-        fclose(f);
-        StringBuffer_trim(proc->name);
-    }
-    // Fallback to procfs stat process name if cmdline was empty (even kernel-space processes have information here),
-    // or if we want to get a thread's name
-    if (!StringBuffer_length(proc->name)) {
-        char buffer[8192];
-        char *tmp = NULL;
-        char *procname = NULL;
-        if (!file_readProc(buffer, sizeof(buffer), "stat", proc->data.pid, proc->data.tid, NULL)) {
-            DEBUG("system statistic error -- cannot read /proc/%d/stat or /proc/%d/task/%d/stat\n",
-                  proc->data.pid,
-                  proc->data.pid,
-                  proc->data.tid);
-            return false;
-        }
-        if (!(tmp = strrchr(buffer, ')'))) {
-            DEBUG("system statistic error -- file /proc/%d/stat or /proc/%d/task/%d/stat parse error\n",
-                  proc->data.pid,
-                  proc->data.pid,
-                  proc->data.tid);
-            return false;
+            for (char *p = buf; (p = memchr(p, 0, (size_t)(buf + n - p))); p++)
+                *p = ' ';
+            StringBuffer_append(proc->name, "%.*s", n, buf);
+            // procfs returns everything available, a short read is the end of the file
+            if (n < (int)sizeof(buf))
+                break;
+            offset += n;
         }
-        *tmp = 0;
-        if (!(procname = strchr(buffer, '('))) {
-            DEBUG("system statistic error -- file /proc/%d/stat or /proc/%d/task/%d/stat parse error\n",
-                  proc->data.pid,
-                  proc->data.pid,
-                  proc->data.tid);
+        if (n < 0) {
+            DEBUG("system statistic error -- cannot read /proc/%d/cmdline: %s\n", proc->data.pid, STRERROR);
             return false;
         }
-        StringBuffer_append(proc->name, "%s", procname + 1);
+        StringBuffer_trim(proc->name);
     }
-
+    // Fallback to procfs stat process name if cmdline was empty (even kernel-space processes have information here),
+    // or if we want to get a thread's name. The stat file was parsed before.
+    if (!StringBuffer_length(proc->name))
+        StringBuffer_append(proc->name, "%s", proc->data.stat.comm);
+    if (proc->data.tid == -1)
+        ProcCache_setCmdline(proc->files, proc->file, key, StringBuffer_toString(proc->name));
     return true;
 }
 
 // parse /proc/PID/attr/current
 static bool _parseProcPidAttrCurrent(Proc_T proc) {
-    if (file_readProc(
-            proc->data.secattr, sizeof(proc->data.secattr), "attr/current", proc->data.pid, proc->data.tid, NULL)) {
+    if (ProcCache_read(
+            proc->files, proc->file, ProcFile_AttrCurrent, proc->data.secattr, sizeof(proc->data.secattr), NULL)) {
         Str_trim(proc->data.secattr);
         return true;
     }
@@ -496,164 +630,297 @@ static bool _parseProcPidAttrCurrent(Proc_T proc) {
 
 // count entries in /proc/PID/fd
 static bool _parseProcFdCount(Proc_T proc) {
-    char path[PATH_MAX] = {};
-    unsigned long long file_count = 0;
-
-    snprintf(path, sizeof(path), "/proc/%d/fd", proc->data.pid);
-    DIR *dirp = opendir(path);
-    if (!dirp) {
-        DEBUG("system statistic error -- opendir %s: %s\n", path, STRERROR);
-        return false;
-    }
-    errno = 0;
-    while (readdir(dirp) != NULL) {
-        // count everything
-        file_count++;
-    }
-    // do not closedir() until readdir errno has been evaluated
-    if (errno) {
-        DEBUG("system statistic error -- cannot iterate %s: %s\n", path, STRERROR);
-        closedir(dirp);
+    long long file_count = ProcCache_countEntries(proc->files, proc->file, ProcFile_Fd);
+    if (file_count < 0) {
+        DEBUG("system statistic error -- cannot iterate /proc/%d/fd: %s\n", proc->data.pid, STRERROR);
         return false;
     }
-    closedir(dirp);
     // assert at least '.' and '..' have been found
     if (file_count < 2) {
-        DEBUG("system statistic error -- cannot find basic entries in %s\n", path);
+        DEBUG("system statistic error -- cannot find basic entries in /proc/%d/fd\n", proc->data.pid);
         return false;
     }
     // subtract entries '.' and '..'
     proc->data.filedescriptors.open = file_count - 2;
 
     // get process's limits
-    snprintf(path, sizeof(path), "/proc/%d/limits", proc->data.pid);
-    FILE *f = fopen(path, "r");
-    if (f) {
+    char buf[4096];
+    if (ProcCache_read(proc->files, proc->file, ProcFile_Limits, buf, sizeof(buf), NULL)) {
         int softLimit;
         int hardLimit;
-        char line[STRLEN];
-        while (fgets(line, sizeof(line), f)) {
-            if (sscanf(line, "Max open files %d %d", &softLimit, &hardLimit) == 2) {
-                proc->data.filedescriptors.limit.soft = softLimit;
-                proc->data.filedescriptors.limit.hard = hardLimit;
-                break;
-            }
+        char *line = strstr(buf, "Max open files");
+        if (line && sscanf(line, "Max open files %d %d", &softLimit, &hardLimit) == 2) {
+            proc->data.filedescriptors.limit.soft = softLimit;
+            proc->data.filedescriptors.limit.hard = hardLimit;
         }
-        fclose(f);
     } else {
-        DEBUG("system statistic error -- cannot open %s\n", path);
+        DEBUG("system statistic error -- cannot read /proc/%d/limits\n", proc->data.pid);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Read the statistics besides the stat file
+ * @param proc process to collect, its stat file was parsed
+ * @param pflags statistics to collect
+ * @return true if all mandatory reads succeeded otherwise false
+ */
+static bool _parseDetails(Proc_T proc, int pflags) {
+    if (!((!(pflags & ProcessTree_CollectCred) || _parseProcPidStatus(proc)) &&
+          (!(pflags & ProcessTree_CollectIo) || _parseProcPidIO(proc)) &&
+          (!(pflags & ProcessTree_CollectCmdline) || _parseProcPidCmdline(proc)))) {
+        return false;
+    }
+    // Non-mandatory statistics (may not exist)
+    if (pflags & ProcessTree_CollectFileDescriptors)
+        _parseProcFdCount(proc);
+    if (pflags & ProcessTree_CollectSecattr)
+        _parseProcPidAttrCurrent(proc);
+    return true;
+}
+
+/**
+ * Set the statistics read by _parseDetails() in a process tree entry
+ * @param proc collected process
+ * @param pt process tree entry to fill
+ * @param pflags collected statistics
+ */
+static void _setDetails(Proc_T proc, ProcessTree_T *pt, int pflags) {
+    if (pflags & ProcessTree_CollectCred) {
+        pt->cred.uid = proc->data.uid;
+        pt->cred.euid = proc->data.euid;
+        pt->cred.gid = proc->data.gid;
+    }
+    if (pflags & ProcessTree_CollectIo) {
+        pt->read.bytes = proc->data.read.bytes;
+        pt->read.bytesPhysical = proc->data.read.bytesPhysical;
+        pt->read.operations = proc->data.read.operations;
+        pt->write.bytes = proc->data.write.bytes;
+        pt->write.bytesPhysical = proc->data.write.bytesPhysical;
+        pt->write.operations = proc->data.write.operations;
+        pt->read.time = pt->write.time = Time_milli();
+    }
+    if (pflags & ProcessTree_CollectCmdline)
+        pt->cmdline = Arena_dup(proc->arena, StringBuffer_toString(proc->name));
+    if (pflags & ProcessTree_CollectSecattr)
+        pt->secattr = Arena_dup(proc->arena, proc->data.secattr);
+    if (pflags & ProcessTree_CollectFileDescriptors) {
+        pt->filedescriptors.usage = proc->data.filedescriptors.open;
+        pt->filedescriptors.limit.soft = proc->data.filedescriptors.limit.soft;
+        pt->filedescriptors.limit.hard = proc->data.filedescriptors.limit.hard;
+    }
+}
+
+/**
+ * Collect the statistics of one process (or thread) into a process tree entry
+ * @param proc process to collect, proc->data.pid, proc->data.tid and proc->file are set
+ * @param pt process tree entry to fill
+ * @param pid process to collect the threads of, or ALL_PROCESSES
+ * @param pflags statistics to collect
+ * @param starttime system start time
+ * @return true if all process related reads succeeded otherwise false
+ */
+static bool _collectProcess(Proc_T proc, ProcessTree_T *pt, int pid, int pflags, time_t starttime) {
+    if (!(_parseProcPidStat(proc) && _parseDetails(proc, pflags))) {
         return false;
     }
+    // Set the data in ptree only if all process related reads succeeded (prevent partial data in the case that
+    // continue was called during data collecting)
+    if (pid == ALL_PROCESSES) {
+        pt->pid = proc->data.pid;
+    } else {
+        pt->pid = proc->data.tid;
+    }
 
+    pt->ppid = proc->data.stat.ppid;
+    pt->threads.self = proc->data.stat.threads;
+    pt->starttime = proc->data.stat.starttime;
+    Str_copy(pt->comm, proc->data.stat.comm, sizeof(pt->comm) - 1);
+    pt->uptime = starttime > 0 ? ((Time_milli() / 100.) / 10. -
+                                  (starttime + (time_t)(proc->data.stat.starttime / g_fixed_system_info.hz)))
+                               : 0;
+    pt->cpu.time = (double)(proc->data.stat.utime + proc->data.stat.stime) / g_fixed_system_info.hz *
+                   100.;  // jiffies -> seconds = 1/hz
+    pt->memory.usage = (unsigned long long)proc->data.stat.rss * (unsigned long long)g_fixed_system_info.page_size;
+    pt->zombie = proc->data.stat.state == 'Z' ? true : false;
+    pt->faults.minor = proc->data.stat.minflt;
+    pt->faults.major = proc->data.stat.majflt;
+    pt->processor = proc->data.stat.processor;
+    pt->priority = proc->data.stat.priority;
+    pt->nice = proc->data.stat.nice;
+    _setDetails(proc, pt, pflags);
     return true;
 }
 
+/**
+ * Processes found in /proc, split in shards which are collected independently. Every shard writes its entries to the
+ * beginning of its own range of the process tree, so concatenating the shards gives the order of the serial scan.
+ */
+typedef struct Scan_T {
+    int pid;
+    int pflags;
+    time_t starttime;
+    int size;
+    int shards;
+    int *ids;  // pid, or tid if collecting threads
+    ProcCache_T files;
+    ProcCache_Entry_T **file;
+    Arena_T arena;
+    ProcessTree_T *pt;
+    int *count;  // Number of collected entries of every shard
+} *Scan_T;
+
+// Shards are small enough to balance the workers and big enough to keep the scheduling overhead low
+#define SCAN_SHARD_MIN 16
+#define SCAN_SHARDS_PER_WORKER 4
+
+static inline int _shardBegin(Scan_T scan, int shard) {
+    return (int)((long)scan->size * shard / scan->shards);
+}
+
+static void _scanShard(void *arg, int shard) {
+    Scan_T scan = arg;
+    int begin = _shardBegin(scan, shard);
+    int end = _shardBegin(scan, shard + 1);
+    int count = 0;
+    struct Proc_T proc = {.name = StringBuffer_create(64), .files = scan->files, .arena = scan->arena};
+    for (int i = begin; i < end; i++) {
+        memset(&proc.data, 0, sizeof(proc.data));
+        StringBuffer_clear(proc.name);
+        if (scan->pid == ALL_PROCESSES) {
+            proc.data.pid = scan->ids[i];
+            proc.data.tid = -1;
+        } else {
+            proc.data.pid = scan->pid;
+            proc.data.tid = scan->ids[i];
+        }
+        proc.file = scan->file[i];
+        if (_collectProcess(&proc, &scan->pt[begin + count], scan->pid, scan->pflags, scan->starttime))
+            count++;
+    }
+    StringBuffer_free(&(proc.name));
+    scan->count[shard] = count;
+}
+
 /* ------------------------------------------------------------------ Public */
 
 /**
  * Read all processes of the proc files system to initialize the process tree
  * @param reference reference of ProcessTree
- * @param pflags Process engine flags
+ * @param capacity set to the number of entries allocated for the process tree, including room for virtual parents
+ * @param context context of the process tree
+ * @param pid process to collect the threads of, or ALL_PROCESSES
+ * @param pflags statistics to collect
  * @return treesize > 0 if succeeded otherwise 0
  */
-static int _initprocesstree_sysdep(ProcessTree_T **reference, int pid) {
+static int _initprocesstree_sysdep(
+    ProcessTree_T **reference, int *capacity, ProcessTree_Context_T context, int pid, int pflags) {
     assert(reference);
 
     // Find all processes in the /proc directory, or all threads in the /proc/<pid>/task directory
-    glob_t globbuf;
-
-    if (pid == ALL_PROCESSES) {
-        int rv = glob("/proc/[0-9]*", 0, NULL, &globbuf);
+    if (!ProcDir_open(context->directory, pid)) {
+        if (pid == ALL_PROCESSES)
+            Log_error("system statistic error -- cannot open /proc: %s\n", STRERROR);
+        return 0;
+    }
 
-        if (rv) {
-            Log_error("system statistic error -- glob failed: %d (%s)\n", rv, STRERROR);
-            return 0;
+    struct Scan_T scan = {.pid = pid,
+                          .pflags = pflags,
+                          .starttime = _getStartTime(),
+                          .files = context->files,
+                          .arena = context->arenas[context->arena].arena};
+    int ids = PidIndex_size(context->index) + 64;
+    scan.ids = ALLOC((long)sizeof(int) * ids);
+    for (int id; (id = ProcDir_next(context->directory)) >= 0;) {
+        if (scan.size == ids) {
+            ids *= 2;
+            RESIZE(scan.ids, (long)sizeof(int) * ids);
         }
-    } else {
-        char pattern[128];
+        scan.ids[scan.size++] = id;
+    }
+    ProcDir_close(context->directory);
 
-        snprintf(pattern, sizeof(pattern), "/proc/%d/task/[0-9]*", pid);
+    if (scan.size == 0) {
+        FREE(scan.ids);
+        return 0;
+    }
 
-        int rv = glob(pattern, 0, NULL, &globbuf);
+    scan.file = CALLOC(sizeof(ProcCache_Entry_T *), scan.size);
+    *capacity = scan.size + (pid == ALL_PROCESSES ? VIRTUAL_PARENTS : 0);
+    scan.pt = Arena_calloc(scan.arena, *capacity, sizeof(ProcessTree_T));
+
+    ProcCache_begin(context->files);
+    ProcCache_reserve(context->files, scan.size);
+    for (int i = 0; i < scan.size; i++) {
+        if (pid == ALL_PROCESSES)
+            scan.file[i] = ProcCache_get(context->files, scan.ids[i], -1);
+        else
+            scan.file[i] = ProcCache_get(context->files, pid, scan.ids[i]);
+    }
 
-        if (rv) {
-            DEBUG("system statistic error -- glob %s failed: %d (%s)\n", pattern, rv, STRERROR);
-            return 0;
-        }
+    if (context->workers && scan.size >= 2 * SCAN_SHARD_MIN) {
+        scan.shards = WorkerPool_workers(context->workers) * SCAN_SHARDS_PER_WORKER;
+        if (scan.shards > scan.size / SCAN_SHARD_MIN)
+            scan.shards = scan.size / SCAN_SHARD_MIN;
+    } else {
+        scan.shards = 1;
     }
+    scan.count = CALLOC(sizeof(int), scan.shards);
 
-    ProcessTree_T *pt = CALLOC(sizeof(ProcessTree_T), globbuf.gl_pathc);
+    if (scan.shards > 1)
+        WorkerPool_run(context->workers, _scanShard, &scan, scan.shards);
+    else
+        _scanShard(&scan, 0);
 
+    // Merge the shards in order
     int count = 0;
-    struct Proc_T proc = {.name = StringBuffer_create(64)};
-    time_t starttime = _getStartTime();
-    for (size_t i = 0; i < globbuf.gl_pathc; i++) {
-        if (pid == ALL_PROCESSES) {
-            proc.data.pid = atoi(globbuf.gl_pathv[i] + 6);  // Skip "/proc/"
-            proc.data.tid = -1;
-        } else {
-            int pid_copy = pid;
-            int digits = 0;
+    for (int shard = 0; shard < scan.shards; shard++) {
+        int begin = _shardBegin(&scan, shard);
+        if (count != begin)
+            memmove(&scan.pt[count], &scan.pt[begin], sizeof(ProcessTree_T) * scan.count[shard]);
+        count += scan.count[shard];
+    }
 
-            while (pid_copy > 0) {
-                pid_copy /= 10;
-                digits++;
-            }
+    ProcCache_end(context->files);
+    FREE(scan.count);
+    FREE(scan.file);
+    FREE(scan.ids);
 
-            // DO NOT MODIFY pid!
-            proc.data.pid = pid;
-            proc.data.tid = atoi(globbuf.gl_pathv[i] + 6 + digits + 6);  // Skip "/proc/<pid>/task/"
-        }
+    *reference = scan.pt;
 
-        if (_parseProcPidStat(&proc) && _parseProcPidStatus(&proc) && _parseProcPidIO(&proc) &&
-            _parseProcPidCmdline(&proc)) {
-            // Non-mandatory statistics (may not exist)
-            _parseProcFdCount(&proc);
-            _parseProcPidAttrCurrent(&proc);
-            // Set the data in ptree only if all process related reads succeeded (prevent partial data in the case that
-            // continue was called during data collecting)
-            if (pid == ALL_PROCESSES) {
-                pt[count].pid = proc.data.pid;
-            } else {
-                pt[count].pid = proc.data.tid;
-            }
+    return count;
+}
 
-            pt[count].ppid = proc.data.ppid;
-            pt[count].cred.uid = proc.data.uid;
-            pt[count].cred.euid = proc.data.euid;
-            pt[count].cred.gid = proc.data.gid;
-            pt[count].threads.self = proc.data.item_threads;
-            pt[count].uptime = starttime > 0
-                                   ? ((Time_milli() / 100.) / 10. -
-                                      (starttime + (time_t)(proc.data.item_starttime / g_fixed_system_info.hz)))
-                                   : 0;
-            pt[count].cpu.time = (double)(proc.data.item_utime + proc.data.item_stime) / g_fixed_system_info.hz *
-                                 100.;  // jiffies -> seconds = 1/hz
-            pt[count].memory.usage =
-                (unsigned long long)proc.data.item_rss * (unsigned long long)g_fixed_system_info.page_size;
-            pt[count].read.bytes = proc.data.read.bytes;
-            pt[count].read.bytesPhysical = proc.data.read.bytesPhysical;
-            pt[count].read.operations = proc.data.read.operations;
-            pt[count].write.bytes = proc.data.write.bytes;
-            pt[count].write.bytesPhysical = proc.data.write.bytesPhysical;
-            pt[count].write.operations = proc.data.write.operations;
-            pt[count].read.time = pt[count].write.time = Time_milli();
-            pt[count].zombie = proc.data.item_state == 'Z' ? true : false;
-            pt[count].cmdline = Str_dup(StringBuffer_toString(proc.name));
-            pt[count].secattr = Str_dup(proc.data.secattr);
-            pt[count].filedescriptors.usage = proc.data.filedescriptors.open;
-            pt[count].filedescriptors.limit.soft = proc.data.filedescriptors.limit.soft;
-            pt[count].filedescriptors.limit.hard = proc.data.filedescriptors.limit.hard;
-            count++;
-            // Clear
-            memset(&proc.data, 0, sizeof(proc.data));
-            StringBuffer_clear(proc.name);
-        }
+/**
+ * Collect more statistics of one process (or thread) of the process tree
+ * @return true if succeeded, false if the process exited or the reads failed
+ */
+bool ProcessTree_collect(
+    ProcessTree_T *pTree, __attribute__((unused)) int treeSize, ProcessTree_Context_T context, int index, int pflags) {
+    assert(pTree);
+    assert(context);
+    assert(index >= 0 && index < treeSize);
+    ProcessTree_T *pt = &pTree[index];
+    // Virtual parents are not in /proc
+    if (pt->pid <= 0)
+        return false;
+    struct Proc_T proc = {
+        .name = StringBuffer_create(64), .files = context->files, .arena = context->arenas[context->arena].arena};
+    if (context->pid == ALL_PROCESSES) {
+        proc.data.pid = pt->pid;
+        proc.data.tid = -1;
+    } else {
+        proc.data.pid = context->pid;
+        proc.data.tid = pt->pid;
     }
+    proc.file = ProcCache_get(context->files, proc.data.pid, proc.data.tid);
+    // Read stat again to detect a pid reused since ProcessTree_init()
+    unsigned long long starttime = proc.file->starttime;
+    bool rv = _parseProcPidStat(&proc) && proc.data.stat.starttime == starttime && _parseDetails(&proc, pflags);
+    if (rv)
+        _setDetails(&proc, pt, pflags);
     StringBuffer_free(&(proc.name));
-
-    *reference = pt;
-    globfree(&globbuf);
-
-    return count;
+    return rv;
 }
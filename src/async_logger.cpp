@@ -0,0 +1,177 @@
+#include <simple_process_monitor/async_logger.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+
+namespace simple_process_monitor {
+
+static size_t roundUpToPowerOfTwo(size_t n) {
+    size_t p = 1;
+
+    while (p < n) {
+        p <<= 1;
+    }
+
+    return p;
+}
+
+AsyncLogger::AsyncLogger(SINK sink, AsyncLoggerOptions options)
+    : sink_(std::move(sink))
+    , options_(options)
+    , mask_(roundUpToPowerOfTwo(std::max<size_t>(options.capacity, 2)) - 1)
+    , slots_(new Slot[mask_ + 1]) {
+    assert(options_.batchSize > 0);
+
+    for (size_t i = 0; i <= mask_; i++) {
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    drainer_ = std::thread{&AsyncLogger::drain, this};
+}
+
+AsyncLogger::~AsyncLogger() {
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+
+        stopping_ = true;
+    }
+
+    wakeDrainer_.notify_one();
+    drainer_.join();
+}
+
+bool AsyncLogger::tryEnqueue(std::string &record) {
+    size_t position = enqueuePosition_.load(std::memory_order_relaxed);
+    Slot *slot;
+
+    for (;;) {
+        slot = &slots_[position & mask_];
+
+        const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+        if (diff == 0) {
+            if (enqueuePosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The drainer has not freed the slot of the previous round yet
+            return false;
+        } else {
+            position = enqueuePosition_.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->record = std::move(record);
+    slot->sequence.store(position + 1, std::memory_order_release);
+
+    return true;
+}
+
+bool AsyncLogger::log(std::string record) {
+    bool enqueued = tryEnqueue(record);
+
+    if (!enqueued && options_.policy == OverflowPolicy::BLOCK) {
+        const auto deadline = std::chrono::steady_clock::now() + options_.blockTimeout;
+
+        for (int attempt = 0; !enqueued && std::chrono::steady_clock::now() < deadline; attempt++) {
+            if (attempt < 16) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            }
+
+            enqueued = tryEnqueue(record);
+        }
+    }
+
+    if (!enqueued) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Either the drainer sees the count go up before it sleeps, or this sees it asleep: both are sequentially
+    // consistent, the drainer announces its sleep before reading the count
+    enqueued_.fetch_add(1, std::memory_order_seq_cst);
+
+    if (sleeping_.load(std::memory_order_seq_cst)) {
+        std::lock_guard<std::mutex> lock{mutex_};
+
+        wakeDrainer_.notify_one();
+    }
+
+    return true;
+}
+
+void AsyncLogger::flush() {
+    // Records are written in the order of their positions. A position is reserved before its record is stored and
+    // counted, so a record enqueued by a log() call still running on another thread is waited for as well.
+    const size_t target = enqueuePosition_.load(std::memory_order_acquire);
+
+    std::unique_lock<std::mutex> lock{mutex_};
+
+    drained_.wait(lock, [this, target]() {
+        return written_.load(std::memory_order_relaxed) >= target;
+    });
+}
+
+void AsyncLogger::drain() {
+    std::string batch;
+
+    const auto ready = [this]() {
+        return slots_[dequeuePosition_ & mask_].sequence.load(std::memory_order_acquire) == dequeuePosition_ + 1;
+    };
+
+    for (;;) {
+        size_t records = 0;
+
+        batch.clear();
+
+        while (records < options_.batchSize && ready()) {
+            Slot &slot = slots_[dequeuePosition_ & mask_];
+
+            batch += slot.record;
+            slot.record.clear();
+            slot.sequence.store(dequeuePosition_ + mask_ + 1, std::memory_order_release);
+
+            dequeuePosition_++;
+            records++;
+        }
+
+        if (records > 0) {
+            if (sink_(batch) < 0) {
+                failed_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            batches_.fetch_add(1, std::memory_order_relaxed);
+            written_.fetch_add(records, std::memory_order_relaxed);
+
+            {
+                std::lock_guard<std::mutex> lock{mutex_};
+            }
+
+            drained_.notify_all();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock{mutex_};
+
+        if (stopping_) {
+            return;
+        }
+
+        sleeping_.store(true, std::memory_order_seq_cst);
+
+        // Every record counted was enqueued before, its producer wakes the drainer up if it missed the count. An idle
+        // drainer sleeps until then.
+        wakeDrainer_.wait(lock, [this]() {
+            return stopping_ || enqueued_.load(std::memory_order_seq_cst) != dequeuePosition_;
+        });
+
+        sleeping_.store(false, std::memory_order_relaxed);
+    }
+}
+
+}  // namespace simple_process_monitor
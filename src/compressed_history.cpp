@@ -0,0 +1,354 @@
+#include <simple_process_monitor/compressed_history.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace simple_process_monitor {
+
+namespace {
+
+class BitReader {
+public:
+    explicit BitReader(const std::vector<uint8_t> &bytes)
+        : bytes_(bytes.data()) {}
+
+    uint64_t read(int bits) {
+        uint64_t value = 0;
+
+        while (bits > 0) {
+            const int available = 8 - static_cast<int>(position_ % 8);
+            const int take = std::min(available, bits);
+            const unsigned part = (bytes_[position_ / 8] >> (available - take)) & ((1u << take) - 1);
+
+            value = (value << take) | part;
+            position_ += static_cast<size_t>(take);
+            bits -= take;
+        }
+
+        return value;
+    }
+
+private:
+    const uint8_t *bytes_;
+    size_t position_ = 0;
+};
+
+// Counters, the metrics after CPU
+constexpr size_t kCounterCount = kHistoryMetricCount - 1;
+
+uint64_t toBits(double value) {
+    uint64_t bits;
+
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    return bits;
+}
+
+double fromBits(uint64_t bits) {
+    double value;
+
+    std::memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+uint64_t zigzag(long long value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+long long unzigzag(uint64_t value) {
+    return static_cast<long long>(value >> 1) ^ -static_cast<long long>(value & 1);
+}
+
+void writeVarint(std::vector<uint8_t> &bytes, uint64_t value) {
+    while (value >= 0x80) {
+        bytes.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+
+    bytes.push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t readVarint(const uint8_t *&p) {
+    uint64_t value = 0;
+
+    for (int shift = 0;; shift += 7) {
+        const uint8_t byte = *p++;
+
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+// The two's complement value of the low bits of an encoded delta-of-delta
+long long signExtend(uint64_t value, int bits) {
+    return value > (1ull << (bits - 1)) ? static_cast<long long>(value) - (1ll << bits) : static_cast<long long>(value);
+}
+
+}  // namespace
+
+void CompressedSeries::BitWriter::write(uint64_t value, int bits) {
+    while (bits > 0) {
+        if (bits_ % 8 == 0) {
+            bytes_.push_back(0);
+        }
+
+        const int free = 8 - static_cast<int>(bits_ % 8);
+        const int take = std::min(free, bits);
+        const auto part = static_cast<unsigned>((value >> (bits - take)) & ((1u << take) - 1));
+
+        bytes_.back() = static_cast<uint8_t>(bytes_.back() | (part << (free - take)));
+        bits_ += static_cast<size_t>(take);
+        bits -= take;
+    }
+}
+
+CompressedSeries::CompressedSeries(size_t chunkSamples)
+    : chunkSamples_(chunkSamples) {
+    assert(chunkSamples > 0);
+}
+
+void CompressedSeries::push(long long time, const HistoryValues &values) {
+    if (chunks_.empty() || chunks_.back().count == chunkSamples_) {
+        if (!chunks_.empty()) {
+            Chunk &sealed = chunks_.back();
+
+            sealed.times.shrink();
+            sealed.cpu.shrink();
+            sealed.counters.shrink_to_fit();
+        }
+
+        chunks_.emplace_back();
+        encoder_ = Encoder{};
+    }
+
+    Chunk &chunk = chunks_.back();
+    const uint64_t cpuBits = toBits(values[static_cast<size_t>(HistoryMetric::CPU)]);
+
+    if (chunk.count == 0) {
+        chunk.first = time;
+        chunk.cpu.write(cpuBits, 64);
+    } else {
+        assert(time >= chunk.last);
+
+        // Samples are taken at a fixed interval, so the delta of the deltas is mostly 0 or a small jitter
+        const long long delta = time - chunk.last;
+        const long long dod = delta - encoder_.delta;
+
+        if (dod == 0) {
+            chunk.times.write(0, 1);
+        } else if (dod >= -63 && dod <= 64) {
+            chunk.times.write(0b10, 2);
+            chunk.times.write(static_cast<uint64_t>(dod), 7);
+        } else if (dod >= -255 && dod <= 256) {
+            chunk.times.write(0b110, 3);
+            chunk.times.write(static_cast<uint64_t>(dod), 9);
+        } else if (dod >= -2047 && dod <= 2048) {
+            chunk.times.write(0b1110, 4);
+            chunk.times.write(static_cast<uint64_t>(dod), 12);
+        } else {
+            chunk.times.write(0b1111, 4);
+            chunk.times.write(static_cast<uint64_t>(dod), 64);
+        }
+
+        encoder_.delta = delta;
+
+        // Consecutive usages share sign, exponent and high mantissa bits, the XOR keeps the few bits which differ
+        const uint64_t x = cpuBits ^ encoder_.cpuBits;
+
+        if (x == 0) {
+            chunk.cpu.write(0, 1);
+        } else {
+            const int leading = std::min(__builtin_clzll(x), 31);
+            const int trailing = __builtin_ctzll(x);
+
+            if (encoder_.leading >= 0 && leading >= encoder_.leading && trailing >= encoder_.trailing) {
+                chunk.cpu.write(0b10, 2);
+                chunk.cpu.write(x >> encoder_.trailing, 64 - encoder_.leading - encoder_.trailing);
+            } else {
+                const int meaningful = 64 - leading - trailing;
+
+                chunk.cpu.write(0b11, 2);
+                chunk.cpu.write(static_cast<uint64_t>(leading), 5);
+                chunk.cpu.write(static_cast<uint64_t>(meaningful - 1), 6);
+                chunk.cpu.write(x >> trailing, meaningful);
+
+                encoder_.leading = leading;
+                encoder_.trailing = trailing;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < kCounterCount; i++) {
+        const long long value = std::llround(values[i + 1]);
+
+        writeVarint(chunk.counters, zigzag(value - encoder_.counterValues[i]));
+        encoder_.counterValues[i] = value;
+    }
+
+    encoder_.cpuBits = cpuBits;
+    chunk.last = time;
+    chunk.count++;
+}
+
+void CompressedSeries::decode(const Chunk &chunk, long long from, long long to, std::vector<HistorySample> &samples) {
+    BitReader times{chunk.times.bytes()};
+    BitReader cpu{chunk.cpu.bytes()};
+    const uint8_t *counters = chunk.counters.data();
+
+    long long time = chunk.first;
+    long long delta = 0;
+    uint64_t cpuBits = 0;
+    int leading = 0;
+    int trailing = 0;
+    long long counterValues[kCounterCount] = {};
+
+    for (uint32_t i = 0; i < chunk.count; i++) {
+        if (i == 0) {
+            cpuBits = cpu.read(64);
+        } else {
+            long long dod = 0;
+
+            if (times.read(1)) {
+                if (!times.read(1)) {
+                    dod = signExtend(times.read(7), 7);
+                } else if (!times.read(1)) {
+                    dod = signExtend(times.read(9), 9);
+                } else if (!times.read(1)) {
+                    dod = signExtend(times.read(12), 12);
+                } else {
+                    dod = static_cast<long long>(times.read(64));
+                }
+            }
+
+            delta += dod;
+            time += delta;
+
+            if (cpu.read(1)) {
+                if (cpu.read(1)) {
+                    leading = static_cast<int>(cpu.read(5));
+                    trailing = 64 - leading - (static_cast<int>(cpu.read(6)) + 1);
+                }
+
+                cpuBits ^= cpu.read(64 - leading - trailing) << trailing;
+            }
+        }
+
+        HistorySample sample{time, {}};
+
+        sample.values[static_cast<size_t>(HistoryMetric::CPU)] = fromBits(cpuBits);
+
+        for (size_t j = 0; j < kCounterCount; j++) {
+            counterValues[j] += unzigzag(readVarint(counters));
+            sample.values[j + 1] = static_cast<double>(counterValues[j]);
+        }
+
+        if (time >= from && time < to) {
+            samples.push_back(sample);
+        }
+    }
+}
+
+std::vector<HistorySample> CompressedSeries::query(long long from, long long to) const {
+    std::vector<HistorySample> samples;
+
+    // The first chunk which ends in the range
+    auto it = std::lower_bound(chunks_.begin(), chunks_.end(), from, [](const Chunk &chunk, long long time) {
+        return chunk.last < time;
+    });
+
+    for (; it != chunks_.end() && it->first < to; ++it) {
+        decode(*it, from, to, samples);
+    }
+
+    return samples;
+}
+
+void CompressedSeries::dropBefore(long long time) {
+    auto it = std::find_if(chunks_.begin(), chunks_.end(), [time](const Chunk &chunk) {
+        return chunk.last >= time;
+    });
+
+    chunks_.erase(chunks_.begin(), it);
+}
+
+size_t CompressedSeries::samples() const {
+    size_t samples = 0;
+
+    for (const Chunk &chunk : chunks_) {
+        samples += chunk.count;
+    }
+
+    return samples;
+}
+
+size_t CompressedSeries::bytes() const {
+    size_t bytes = chunks_.capacity() * sizeof(Chunk);
+
+    for (const Chunk &chunk : chunks_) {
+        bytes += chunk.times.bytes().capacity() + chunk.cpu.bytes().capacity() + chunk.counters.capacity();
+    }
+
+    return bytes;
+}
+
+CompressedHistory::CompressedHistory(long long retention, size_t chunkSamples)
+    : retention_(retention)
+    , chunkSamples_(chunkSamples)
+    , system_(chunkSamples) {}
+
+void CompressedHistory::record(long long time, const ProcessTreeSnapshot &snapshot) {
+    series_.evict(snapshot);
+
+    for (const ProcessTree_T &p : snapshot) {
+        // Skip the virtual root
+        if (p.pid <= 0) {
+            continue;
+        }
+
+        CompressedSeries *series = series_.find(p);
+
+        if (!series) {
+            series = &series_.track(p, CompressedSeries{chunkSamples_});
+        }
+
+        series->push(time, historyValuesOf(p));
+        series->dropBefore(time - retention_);
+    }
+}
+
+void CompressedHistory::record(long long time, const SystemInfo_T &systemInfo) {
+    system_.push(time, historyValuesOf(systemInfo));
+    system_.dropBefore(time - retention_);
+}
+
+const CompressedSeries *CompressedHistory::process(pid_t pid) const {
+    return series_.find(pid);
+}
+
+size_t CompressedHistory::samples() const {
+    size_t samples = system_.samples();
+
+    for (const auto &[pid, tracked] : series_) {
+        samples += tracked.series.samples();
+    }
+
+    return samples;
+}
+
+size_t CompressedHistory::bytes() const {
+    size_t bytes = system_.bytes();
+
+    for (const auto &[pid, tracked] : series_) {
+        bytes += tracked.series.bytes();
+    }
+
+    return bytes;
+}
+
+}  // namespace simple_process_monitor
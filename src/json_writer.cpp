@@ -0,0 +1,399 @@
+#include <simple_process_monitor/json_writer.h>
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+namespace simple_process_monitor {
+
+size_t utf8Length(const unsigned char *p, const unsigned char *end) {
+    const unsigned c = p[0];
+    size_t n;
+    uint32_t codePoint;
+    uint32_t min;
+
+    if (c < 0x80) {
+        return 1;
+    } else if ((c & 0xe0) == 0xc0) {
+        n = 2;
+        codePoint = c & 0x1f;
+        min = 0x80;
+    } else if ((c & 0xf0) == 0xe0) {
+        n = 3;
+        codePoint = c & 0x0f;
+        min = 0x800;
+    } else if ((c & 0xf8) == 0xf0) {
+        n = 4;
+        codePoint = c & 0x07;
+        min = 0x10000;
+    } else {
+        return 0;
+    }
+
+    if (static_cast<size_t>(end - p) < n) {
+        return 0;
+    }
+
+    for (size_t i = 1; i < n; i++) {
+        if ((p[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+
+        codePoint = (codePoint << 6) | (p[i] & 0x3f);
+    }
+
+    // Overlong encodings, surrogates and beyond Unicode
+    if (codePoint < min || codePoint > 0x10ffff || (codePoint >= 0xd800 && codePoint <= 0xdfff)) {
+        return 0;
+    }
+
+    return n;
+}
+
+bool JsonWriter::writeToFd(void *context, const char *data, size_t size) {
+    const int fd = static_cast<JsonWriter *>(context)->fd_;
+
+    while (size > 0) {
+        const ssize_t n = ::write(fd, data, size);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+void JsonWriter::write(const char *data, size_t size) {
+    if (!ok_) {
+        return;
+    }
+
+    if (size > size_ - used_) {
+        if (!flush_ || !flush()) {
+            ok_ = false;
+            return;
+        }
+
+        // Longer than the buffer, bypass it
+        if (size > size_) {
+            ok_ = flush_(context_, data, size);
+            return;
+        }
+    }
+
+    std::memcpy(buf_ + used_, data, size);
+    used_ += size;
+}
+
+bool JsonWriter::flush() {
+    if (flush_ && ok_ && used_ > 0) {
+        ok_ = flush_(context_, buf_, used_);
+        used_ = 0;
+    }
+
+    return ok_;
+}
+
+void JsonWriter::separate() {
+    if (afterKey_) {
+        afterKey_ = false;
+        return;
+    }
+
+    if (depth_ == 0) {
+        return;
+    }
+
+    const uint64_t bit = uint64_t{1} << (depth_ - 1);
+
+    if (hasElements_ & bit) {
+        write(",");
+    }
+
+    hasElements_ |= bit;
+}
+
+JsonWriter &JsonWriter::open(char c) {
+    separate();
+
+    if (depth_ == kMaxDepth) {
+        ok_ = false;
+        return *this;
+    }
+
+    write(&c, 1);
+    depth_++;
+    hasElements_ &= ~(uint64_t{1} << (depth_ - 1));
+
+    return *this;
+}
+
+JsonWriter &JsonWriter::close(char c) {
+    if (depth_ > 0) {
+        depth_--;
+    }
+
+    write(&c, 1);
+
+    return *this;
+}
+
+JsonWriter &JsonWriter::key(std::string_view name) {
+    separate();
+    writeString(name);
+    write(":");
+    afterKey_ = true;
+
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(const char *s) {
+    return s ? value(std::string_view{s}) : null();
+}
+
+JsonWriter &JsonWriter::value(std::string_view s) {
+    separate();
+    writeString(s);
+
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(float x) {
+    if (!std::isfinite(x)) {
+        return null();
+    }
+
+    char buf[32];
+
+    separate();
+    write(buf, static_cast<size_t>(std::to_chars(buf, buf + sizeof(buf), x).ptr - buf));
+
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(double x) {
+    if (!std::isfinite(x)) {
+        return null();
+    }
+
+    char buf[32];
+
+    separate();
+    write(buf, static_cast<size_t>(std::to_chars(buf, buf + sizeof(buf), x).ptr - buf));
+
+    return *this;
+}
+
+void JsonWriter::writeString(std::string_view s) {
+    static const char kHex[] = "0123456789abcdef";
+
+    const auto *p = reinterpret_cast<const unsigned char *>(s.data());
+    const auto *end = p + s.size();
+
+    write("\"");
+
+    while (p < end) {
+        // The longest run which needs no escaping is written at once
+        const unsigned char *run = p;
+
+        while (p < end && *p >= 0x20 && *p != '"' && *p != '\\') {
+            const size_t n = *p < 0x80 ? 1 : utf8Length(p, end);
+
+            if (n == 0) {
+                break;
+            }
+
+            p += n;
+        }
+
+        write(reinterpret_cast<const char *>(run), static_cast<size_t>(p - run));
+
+        if (p == end) {
+            break;
+        }
+
+        switch (*p) {
+            case '"':
+                write("\\\"");
+                break;
+            case '\\':
+                write("\\\\");
+                break;
+            case '\n':
+                write("\\n");
+                break;
+            case '\r':
+                write("\\r");
+                break;
+            case '\t':
+                write("\\t");
+                break;
+            default:
+                if (*p < 0x20) {
+                    const char escape[] = {'\\', 'u', '0', '0', kHex[*p >> 4], kHex[*p & 0xf]};
+
+                    write(escape, sizeof(escape));
+                } else {
+                    write("\\ufffd");
+                }
+        }
+
+        p++;
+    }
+
+    write("\"");
+}
+
+void writeJsonMembers(JsonWriter &writer, const ProcessOrThreadInfo &info) {
+    writer.key("pid")
+        .value(info.pid)
+        .key("threads")
+        .value(info.threadNum)
+        .key("cpu_usage")
+        .value(info.cpuUsage)
+        .key("ram_usage")
+        .value(info.ramUsage)
+        .key("io_bytes")
+        .value(info.ioBytes)
+        .key("file_descriptors")
+        .value(info.fileDescriptors)
+        .key("cmdline")
+        .value(info.cmdline);
+}
+
+void writeJson(JsonWriter &writer, const ProcessOrThreadInfo &info) {
+    writer.beginObject();
+    writeJsonMembers(writer, info);
+    writer.endObject();
+}
+
+void writeJson(JsonWriter &writer, const TopProcessInfos &infos) {
+    writer.beginArray();
+
+    for (const ProcessOrThreadInfo &info : infos) {
+        writeJson(writer, info);
+    }
+
+    writer.endArray();
+}
+
+void writeJson(JsonWriter &writer, const ProcessTree_T &process) {
+    writer.beginObject()
+        .key("pid")
+        .value(process.pid)
+        .key("ppid")
+        .value(process.ppid)
+        .key("uid")
+        .value(process.cred.uid)
+        .key("euid")
+        .value(process.cred.euid)
+        .key("gid")
+        .value(process.cred.gid)
+        .key("zombie")
+        .value(process.zombie)
+        .key("threads")
+        .value(process.threads.self)
+        .key("children")
+        .value(process.children.total)
+        .key("cpu_usage")
+        .value(process.cpu.usage.self)
+        .key("cpu_usage_children")
+        .value(process.cpu.usage.children)
+        .key("cpu_time")
+        .value(process.cpu.time)
+        .key("memory_usage")
+        .value(process.memory.usage)
+        .key("memory_usage_total")
+        .value(process.memory.usage_total)
+        .key("faults_minor")
+        .value(process.faults.minor)
+        .key("faults_major")
+        .value(process.faults.major)
+        .key("processor")
+        .value(process.processor)
+        .key("priority")
+        .value(process.priority)
+        .key("nice")
+        .value(process.nice)
+        .key("read_bytes")
+        .value(process.read.bytes)
+        .key("read_operations")
+        .value(process.read.operations)
+        .key("write_bytes")
+        .value(process.write.bytes)
+        .key("write_operations")
+        .value(process.write.operations)
+        .key("file_descriptors")
+        .value(process.filedescriptors.usage)
+        .key("uptime")
+        .value(static_cast<long long>(process.uptime))
+        .key("cmdline")
+        .value(process.cmdline)
+        .key("secattr")
+        .value(process.secattr)
+        .endObject();
+}
+
+void writeJson(JsonWriter &writer, const SystemInfo_T &systemInfo) {
+    const auto &usage = systemInfo.cpu.usage;
+
+    writer.beginObject()
+        .key("time")
+        .value(static_cast<long long>(systemInfo.collected.tv_sec) * 1000 + systemInfo.collected.tv_usec / 1000)
+        .key("hostname")
+        .value(systemInfo.uname.nodename)
+        .key("cpu")
+        .beginObject()
+        .key("user")
+        .value(usage.user)
+        .key("nice")
+        .value(usage.nice)
+        .key("system")
+        .value(usage.system)
+        .key("idle")
+        .value(usage.idle)
+        .key("iowait")
+        .value(usage.iowait)
+        .key("hardirq")
+        .value(usage.hardirq)
+        .key("softirq")
+        .value(usage.softirq)
+        .key("steal")
+        .value(usage.steal)
+        .key("guest")
+        .value(usage.guest)
+        .key("guest_nice")
+        .value(usage.guest_nice)
+        .endObject()
+        .key("memory_usage")
+        .value(systemInfo.memory.usage.bytes)
+        .key("memory_usage_percent")
+        .value(systemInfo.memory.usage.percent)
+        .key("swap_size")
+        .value(systemInfo.swap.size)
+        .key("swap_usage")
+        .value(systemInfo.swap.usage.bytes)
+        .key("file_descriptors")
+        .value(systemInfo.filedescriptors.allocated)
+        .key("file_descriptors_maximum")
+        .value(systemInfo.filedescriptors.maximum)
+        .key("loadavg")
+        .beginArray()
+        .value(systemInfo.loadavg[0])
+        .value(systemInfo.loadavg[1])
+        .value(systemInfo.loadavg[2])
+        .endArray()
+        .endObject();
+}
+
+}  // namespace simple_process_monitor
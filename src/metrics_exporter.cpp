@@ -0,0 +1,422 @@
+#include <simple_process_monitor/metrics_exporter.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include <simple_process_monitor/json_writer.h>
+#include <simple_process_monitor/top_k.h>
+
+namespace simple_process_monitor {
+
+static void appendFamily(ReportBuilder &report, const char *name, const char *type, const char *help) {
+    report.appendf("# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+// The program of a cmdline as a label value: up to the first space, escaped, invalid UTF-8 replaced with U+FFFD, and
+// cut at a code point boundary
+static void appendCommand(ReportBuilder &report, const char *cmdline) {
+    static constexpr size_t kMaxCommand = 64;
+    static const char kReplacement[] = "\xef\xbf\xbd";
+
+    if (!cmdline) {
+        return;
+    }
+
+    // Up to 3 bytes more are read to validate a sequence which starts before the cut
+    const size_t length = strnlen(cmdline, kMaxCommand + 3);
+    const char *space = static_cast<const char *>(std::memchr(cmdline, ' ', length));
+    const auto *p = reinterpret_cast<const unsigned char *>(cmdline);
+    const auto *end = space ? reinterpret_cast<const unsigned char *>(space) : p + length;
+
+    // No input byte takes more than the 3 bytes of a replacement
+    char escaped[3 * kMaxCommand];
+    size_t size = 0;
+
+    for (const auto *begin = p; p < end;) {
+        const size_t n = utf8Length(p, end);
+
+        if (static_cast<size_t>(p - begin) + std::max<size_t>(n, 1) > kMaxCommand) {
+            break;
+        }
+
+        if (n == 0) {
+            std::memcpy(escaped + size, kReplacement, sizeof(kReplacement) - 1);
+            size += sizeof(kReplacement) - 1;
+            p++;
+            continue;
+        }
+
+        switch (*p) {
+            case '\\':
+            case '"':
+                escaped[size++] = '\\';
+                escaped[size++] = static_cast<char>(*p);
+                break;
+            case '\n':
+                escaped[size++] = '\\';
+                escaped[size++] = 'n';
+                break;
+            default:
+                std::memcpy(escaped + size, p, n);
+                size += n;
+        }
+
+        p += n;
+    }
+
+    report.append({escaped, size});
+}
+
+static void appendProcessSample(ReportBuilder &report, const char *name, const ProcessTree_T &p) {
+    report.appendf("%s{pid=\"%d\",command=\"", name, p.pid);
+    appendCommand(report, p.cmdline);
+    report.append("\"} ");
+}
+
+// The full response for body
+static void renderResponse(std::string &response, std::string_view body) {
+    char headers[256];
+    const int n = std::snprintf(headers,
+                                sizeof(headers),
+                                "HTTP/1.1 200 OK\r\n"
+                                "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                                "Content-Length: %zu\r\n"
+                                "Connection: close\r\n\r\n",
+                                body.size());
+
+    response.assign(headers, static_cast<size_t>(n));
+    response += body;
+}
+
+// Milliseconds left until deadline, 0 once it passed
+static int remainingMs(std::chrono::steady_clock::time_point deadline) {
+    const auto left =
+        std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+    return left > 0 ? static_cast<int>(left) : 0;
+}
+
+// Waits until the non-blocking client socket is ready for events, false at the deadline or when woken to stop
+static bool waitFor(int fd, short events, int wakeFd, std::chrono::steady_clock::time_point deadline) {
+    for (;;) {
+        pollfd fds[2] = {{fd, events, 0}, {wakeFd, POLLIN, 0}};
+        const int timeout = remainingMs(deadline);
+
+        if (timeout == 0) {
+            return false;
+        }
+
+        const int n = ::poll(fds, 2, timeout);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        return n > 0 && !fds[1].revents;
+    }
+}
+
+static bool sendAll(int fd, const char *data, size_t size, int wakeFd, std::chrono::steady_clock::time_point deadline) {
+    while (size > 0) {
+        const ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && waitFor(fd, POLLOUT, wakeFd, deadline)) {
+                continue;
+            }
+
+            return false;
+        }
+
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+// The pids sorted for binary search
+static MetricsExporterOptions sortPids(MetricsExporterOptions options) {
+    std::sort(options.pids.begin(), options.pids.end());
+
+    return options;
+}
+
+MetricsExporter::MetricsExporter(MetricsExporterOptions options)
+    : options_(sortPids(std::move(options)))
+    , published_(std::make_shared<std::string>()) {
+    renderResponse(*published_, "# EOF\n");
+    response_.store(published_);
+}
+
+bool MetricsExporter::listen(uint16_t port, const std::string &address) {
+    stop();
+
+    sockaddr_in addr{};
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+
+    if (::inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        errno = EINVAL;
+        return false;
+    }
+
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    const int on = 1;
+    socklen_t len = sizeof(addr);
+
+    if (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+        ::bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(fd, SOMAXCONN) != 0 ||
+        ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    wakeFd_ = ::eventfd(0, EFD_CLOEXEC);
+
+    if (wakeFd_ < 0) {
+        ::close(fd);
+        return false;
+    }
+
+    listenFd_ = fd;
+    port_ = ntohs(addr.sin_port);
+    server_ = std::thread{&MetricsExporter::serve, this};
+
+    return true;
+}
+
+void MetricsExporter::stop() {
+    if (listenFd_ < 0) {
+        return;
+    }
+
+    const uint64_t one = 1;
+
+    [[maybe_unused]] const ssize_t n = ::write(wakeFd_, &one, sizeof(one));
+
+    server_.join();
+
+    ::close(listenFd_);
+    ::close(wakeFd_);
+    listenFd_ = wakeFd_ = -1;
+    port_ = 0;
+}
+
+void MetricsExporter::serve() {
+    static const char kNotFound[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+    // Connections are served one at a time, a scraper gets this long to send its request and read the response so a
+    // silent or stalled one delays the others by at most that
+    static constexpr std::chrono::milliseconds kConnectionTimeout{1000};
+
+    pollfd fds[2] = {{listenFd_, POLLIN, 0}, {wakeFd_, POLLIN, 0}};
+    char request[4096];
+
+    for (;;) {
+        if (::poll(fds, 2, -1) < 0 && errno != EINTR) {
+            return;
+        }
+
+        if (fds[1].revents) {
+            return;
+        }
+
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        const int fd = ::accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+
+        if (fd < 0) {
+            continue;
+        }
+
+        const auto deadline = std::chrono::steady_clock::now() + kConnectionTimeout;
+
+        // Only the request line matters, the rest of the headers is read and ignored
+        size_t size = 0;
+
+        while (size < sizeof(request) - 1 && waitFor(fd, POLLIN, wakeFd_, deadline)) {
+            const ssize_t n = ::recv(fd, request + size, sizeof(request) - 1 - size, 0);
+
+            if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+                continue;
+            }
+
+            if (n <= 0) {
+                break;
+            }
+
+            size += static_cast<size_t>(n);
+            request[size] = '\0';
+
+            if (std::strstr(request, "\r\n\r\n")) {
+                break;
+            }
+        }
+
+        request[size] = '\0';
+
+        // No request line before the deadline, nothing to answer
+        if (!std::strstr(request, "\r\n")) {
+            ::close(fd);
+            continue;
+        }
+
+        if (std::strncmp(request, "GET /metrics ", 13) == 0 || std::strncmp(request, "GET / ", 6) == 0) {
+            const std::shared_ptr<const std::string> response = this->response();
+
+            sendAll(fd, response->data(), response->size(), wakeFd_, deadline);
+        } else {
+            sendAll(fd, kNotFound, sizeof(kNotFound) - 1, wakeFd_, deadline);
+        }
+
+        ::close(fd);
+    }
+}
+
+void MetricsExporter::update(const ProcessTreeSnapshot &snapshot, const SystemInfo_T &systemInfo) {
+    renderBody(snapshot, systemInfo);
+
+    // Scrapers still sending the previous response keep it, a new buffer is taken then
+    std::shared_ptr<std::string> response =
+        spare_ && spare_.use_count() == 1 ? std::move(spare_) : std::make_shared<std::string>();
+
+    renderResponse(*response, body_.view());
+    response_.store(response);
+
+    spare_ = std::exchange(published_, std::move(response));
+}
+
+void MetricsExporter::renderBody(const ProcessTreeSnapshot &snapshot, const SystemInfo_T &systemInfo) {
+    ReportBuilder &report = body_;
+
+    report.clear();
+
+    const auto &usage = systemInfo.cpu.usage;
+    const std::pair<const char *, float> modes[] = {{"user", usage.user},
+                                                     {"nice", usage.nice},
+                                                     {"system", usage.system},
+                                                     {"idle", usage.idle},
+                                                     {"iowait", usage.iowait},
+                                                     {"hardirq", usage.hardirq},
+                                                     {"softirq", usage.softirq},
+                                                     {"steal", usage.steal},
+                                                     {"guest", usage.guest},
+                                                     {"guest_nice", usage.guest_nice}};
+
+    appendFamily(report, "spm_system_cpu_usage_percent", "gauge", "CPU time by mode since the previous refresh.");
+
+    // Unknown until the second refresh
+    for (const auto &[mode, percent] : modes) {
+        if (percent < 0) {
+            continue;
+        }
+
+        report.appendf("spm_system_cpu_usage_percent{mode=\"%s\"} %.2f\n", mode, static_cast<double>(percent));
+    }
+
+    appendFamily(report, "spm_system_memory_usage_bytes", "gauge", "Real memory in use.");
+    report.appendf("spm_system_memory_usage_bytes %llu\n", systemInfo.memory.usage.bytes);
+
+    appendFamily(report, "spm_system_swap_usage_bytes", "gauge", "Swap in use.");
+    report.appendf("spm_system_swap_usage_bytes %llu\n", systemInfo.swap.usage.bytes);
+
+    appendFamily(report, "spm_system_file_descriptors", "gauge", "Allocated file descriptors.");
+    report.appendf("spm_system_file_descriptors %lld\n", systemInfo.filedescriptors.allocated);
+
+    appendFamily(report, "spm_system_file_descriptors_limit", "gauge", "File descriptors limit.");
+    report.appendf("spm_system_file_descriptors_limit %lld\n", systemInfo.filedescriptors.maximum);
+
+    appendFamily(report, "spm_system_load_average", "gauge", "Load average.");
+    report.appendf("spm_system_load_average{period=\"1m\"} %.2f\n", systemInfo.loadavg[0]);
+    report.appendf("spm_system_load_average{period=\"5m\"} %.2f\n", systemInfo.loadavg[1]);
+    report.appendf("spm_system_load_average{period=\"15m\"} %.2f\n", systemInfo.loadavg[2]);
+
+    // The top processes by CPU and RAM usages, and the allowed ones, each once in tree order
+    const auto isProcess = [](const ProcessTree_T &p) {
+        return p.pid > 0;
+    };
+
+    std::vector<const ProcessTree_T *> processes =
+        topK<ProcessCpuUsage>(snapshot.begin(), snapshot.end(), options_.topK, isProcess);
+    const std::vector<const ProcessTree_T *> ram =
+        topK<ProcessRamUsage>(snapshot.begin(), snapshot.end(), options_.topK, isProcess);
+
+    processes.insert(processes.end(), ram.begin(), ram.end());
+
+    if (!options_.pids.empty()) {
+        for (const ProcessTree_T &p : snapshot) {
+            if (std::binary_search(options_.pids.begin(), options_.pids.end(), p.pid)) {
+                processes.push_back(&p);
+            }
+        }
+    }
+
+    std::sort(processes.begin(), processes.end());
+    processes.erase(std::unique(processes.begin(), processes.end()), processes.end());
+
+    appendFamily(report, "spm_process_cpu_usage_percent", "gauge", "CPU usage since the previous refresh.");
+
+    for (const ProcessTree_T *p : processes) {
+        if (p->cpu.usage.self < 0) {
+            continue;
+        }
+
+        appendProcessSample(report, "spm_process_cpu_usage_percent", *p);
+        report.appendf("%.2f\n", static_cast<double>(p->cpu.usage.self));
+    }
+
+    appendFamily(report, "spm_process_memory_bytes", "gauge", "Resident memory.");
+
+    for (const ProcessTree_T *p : processes) {
+        appendProcessSample(report, "spm_process_memory_bytes", *p);
+        report.appendf("%llu\n", p->memory.usage);
+    }
+
+    appendFamily(report, "spm_process_threads", "gauge", "Threads.");
+
+    for (const ProcessTree_T *p : processes) {
+        appendProcessSample(report, "spm_process_threads", *p);
+        report.appendf("%d\n", p->threads.self);
+    }
+
+    appendFamily(report, "spm_process_open_file_descriptors", "gauge", "Open file descriptors, 0 if not collected.");
+
+    for (const ProcessTree_T *p : processes) {
+        appendProcessSample(report, "spm_process_open_file_descriptors", *p);
+        report.appendf("%lld\n", p->filedescriptors.usage);
+    }
+
+    appendFamily(report, "spm_process_io_bytes", "counter", "Bytes read and written, 0 if not collected.");
+
+    for (const ProcessTree_T *p : processes) {
+        appendProcessSample(report, "spm_process_io_bytes_total", *p);
+        report.appendf("%lld\n", p->read.bytes + p->write.bytes);
+    }
+
+    report.append("# EOF\n");
+}
+
+}  // namespace simple_process_monitor
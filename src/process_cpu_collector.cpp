@@ -0,0 +1,81 @@
+#include <simple_process_monitor/process_cpu_collector.h>
+
+#include <algorithm>
+
+#include <simple_process_monitor/top_k.h>
+
+namespace simple_process_monitor {
+
+ProcessCpuCollector::ProcessCpuCollector(int count, int candidates, int pflags, int workers)
+    : count_(count)
+    , candidates_(std::max(count, candidates > 0 ? candidates : 2 * count))
+    , processTreeWrapper_(ALL_PROCESSES, pflags | ProcessTree_CollectCpu, workers) {
+    const std::shared_ptr<const ProcessTreeSnapshot> snapshot = processTreeWrapper_.latest();
+
+    std::vector<pid_t> pids;
+
+    for (const ProcessTree_T *p : topK<ProcessCpuTime>(
+             snapshot->begin(), snapshot->end(), static_cast<size_t>(candidates_), [](const ProcessTree_T &process) {
+                 return process.pid > 0;
+             })) {
+        pids.push_back(p->pid);
+    }
+
+    track(pids);
+}
+
+void ProcessCpuCollector::update() {
+    processTreeWrapper_.update();
+
+    for (auto &[pid, threadTreeWrapper] : threadTreeWrappers_) {
+        threadTreeWrapper->update();
+    }
+
+    const TopProcessInfos candidates = processTreeWrapper_.getTopProcessInfos(TopInfoType::CPU, candidates_);
+
+    processes_.clear();
+    threads_.clear();
+
+    std::vector<pid_t> pids;
+
+    pids.reserve(candidates.size());
+
+    for (const ProcessOrThreadInfo &process : candidates) {
+        if (static_cast<int>(processes_.size()) < count_) {
+            auto it = threadTreeWrappers_.find(process.pid);
+
+            processes_.push_back(process);
+
+            if (it != threadTreeWrappers_.end()) {
+                threads_.push_back(it->second->getTopProcessInfos(TopInfoType::CPU, count_));
+            } else {
+                threads_.emplace_back();
+            }
+        }
+
+        pids.push_back(process.pid);
+    }
+
+    track(pids);
+}
+
+// Keeps the thread trees of the candidates only, the trees of new candidates take their first snapshot now
+void ProcessCpuCollector::track(const std::vector<pid_t> &candidates) {
+    std::unordered_map<pid_t, std::unique_ptr<ProcessTreeWrapper>> threadTreeWrappers;
+
+    threadTreeWrappers.reserve(candidates.size());
+
+    for (pid_t pid : candidates) {
+        auto it = threadTreeWrappers_.find(pid);
+
+        if (it != threadTreeWrappers_.end()) {
+            threadTreeWrappers.emplace(pid, std::move(it->second));
+        } else {
+            threadTreeWrappers.emplace(pid, std::make_unique<ProcessTreeWrapper>(pid, ProcessTree_CollectCpu));
+        }
+    }
+
+    threadTreeWrappers_ = std::move(threadTreeWrappers);
+}
+
+}  // namespace simple_process_monitor
@@ -0,0 +1,145 @@
+#include <simple_process_monitor/process_history.h>
+
+#include <algorithm>
+#include <cassert>
+
+namespace simple_process_monitor {
+
+HistoryValues historyValuesOf(const ProcessTree_T &process) {
+    return {process.cpu.usage.self,
+            static_cast<double>(process.memory.usage),
+            static_cast<double>(process.read.bytes + process.write.bytes),
+            static_cast<double>(process.filedescriptors.usage)};
+}
+
+HistoryValues historyValuesOf(const SystemInfo_T &systemInfo) {
+    return {100. - systemInfo.cpu.usage.idle,
+            static_cast<double>(systemInfo.memory.usage.bytes),
+            0.,
+            static_cast<double>(systemInfo.filedescriptors.allocated)};
+}
+
+HistoryRing::HistoryRing(size_t capacity)
+    : times_(capacity) {
+    assert(capacity > 0);
+
+    for (std::vector<double> &column : values_) {
+        column.resize(capacity);
+    }
+}
+
+void HistoryRing::push(long long time, const HistoryValues &values) {
+    assert(size_ == 0 || time >= times_[position(size_ - 1)]);
+
+    times_[head_] = time;
+
+    for (size_t i = 0; i < kHistoryMetricCount; i++) {
+        values_[i][head_] = values[i];
+    }
+
+    head_ = head_ + 1 < capacity() ? head_ + 1 : 0;
+    size_ = size_ < capacity() ? size_ + 1 : size_;
+}
+
+std::pair<size_t, size_t> HistoryRing::find(long long from, long long to) const {
+    // The times are sorted from the oldest sample on, search them as one sequence
+    const auto lowerBound = [this](long long time) {
+        size_t lo = 0;
+        size_t hi = size_;
+
+        while (lo < hi) {
+            const size_t mid = lo + (hi - lo) / 2;
+
+            if (times_[position(mid)] < time) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        return lo;
+    };
+
+    const size_t begin = lowerBound(from);
+
+    return {begin, std::max(begin, lowerBound(to))};
+}
+
+template <typename V>
+ColumnRange<V> HistoryRing::range(const std::vector<V> &column, size_t begin, size_t end) const {
+    assert(begin <= end && end <= size_);
+
+    if (begin == end) {
+        return {column.data(), 0, column.data(), 0};
+    }
+
+    const size_t first = position(begin);
+    const size_t n = end - begin;
+
+    if (first + n <= capacity()) {
+        return {column.data() + first, n, column.data(), 0};
+    }
+
+    return {column.data() + first, capacity() - first, column.data(), first + n - capacity()};
+}
+
+ColumnRange<long long> HistoryRing::times(size_t begin, size_t end) const {
+    return range(times_, begin, end);
+}
+
+ColumnRange<double> HistoryRing::values(HistoryMetric metric, size_t begin, size_t end) const {
+    return range(values_[static_cast<size_t>(metric)], begin, end);
+}
+
+ProcessHistory::ProcessHistory(size_t samples, size_t maxBytes)
+    : samples_(samples)
+    , maxRings_(std::max<size_t>(maxBytes / HistoryRing::bytesOf(samples), 1) - 1)
+    , system_(samples) {}
+
+void ProcessHistory::record(long long time, const ProcessTreeSnapshot &snapshot) {
+    // Evict the processes which exited first, so the new ones can take their rings
+    rings_.evict(snapshot, [this](std::unique_ptr<HistoryRing> &&ring) {
+        spare_.push_back(std::move(ring));
+    });
+
+    for (const ProcessTree_T &p : snapshot) {
+        // Skip the virtual root
+        if (p.pid <= 0) {
+            continue;
+        }
+
+        std::unique_ptr<HistoryRing> *ring = rings_.find(p);
+
+        if (!ring) {
+            if (rings_.size() + spare_.size() >= maxRings_ && spare_.empty()) {
+                continue;
+            }
+
+            if (!spare_.empty()) {
+                ring = &rings_.track(p, std::move(spare_.back()));
+                spare_.pop_back();
+                (*ring)->clear();
+            } else {
+                ring = &rings_.track(p, std::make_unique<HistoryRing>(samples_));
+            }
+        }
+
+        (*ring)->push(time, historyValuesOf(p));
+    }
+}
+
+void ProcessHistory::record(long long time, const SystemInfo_T &systemInfo) {
+    system_.push(time, historyValuesOf(systemInfo));
+}
+
+const HistoryRing *ProcessHistory::process(pid_t pid) const {
+    const std::unique_ptr<HistoryRing> *ring = rings_.find(pid);
+
+    return ring ? ring->get() : nullptr;
+}
+
+size_t ProcessHistory::bytes() const {
+    return (1 + rings_.size() + spare_.size()) * system_.bytes();
+}
+
+}  // namespace simple_process_monitor
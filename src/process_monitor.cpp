@@ -2,114 +2,394 @@
 
 #include <cstdio>
 
+#include <simple_process_monitor/json_writer.h>
+#include <simple_process_monitor/shared_snapshot.h>
+
 namespace simple_process_monitor {
 
-template <typename... Ts>
-static void formatAndLog(ProcessMonitor::LOGGER &logger, const char *fmt, Ts... args) {
-    static constexpr size_t kBufSize = 4096;
+static constexpr std::string_view kSeparator = "------------------------------------------------------------\n";
+
+// Renders a JSON report as one NDJSON line into report, through a buffer on the stack
+template <typename F>
+static void renderJson(ReportBuilder &report, const char *name, F &&render) {
+    char buf[4096];
 
-    char buf[kBufSize];
+    JsonWriter writer{buf,
+                      sizeof(buf),
+                      [](void *context, const char *data, size_t size) {
+                          static_cast<ReportBuilder *>(context)->append({data, size});
+                          return true;
+                      },
+                      &report};
+
+    writer.beginObject()
+        .key("report")
+        .value(name)
+        .key("time")
+        .value(std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+                   .count());
+    render(writer);
+    writer.endObject().endRecord().flush();
+}
 
-    const int n = std::snprintf(buf, sizeof(buf), fmt, args...);
+void ProcessMonitor::startSampling() {
+    std::lock_guard<std::mutex> lock{mutex_};
 
-    if (n < 0) {
-        logger("formatAndLog: snprintf formatting error");
+    if (sampling_) {
         return;
     }
 
-    if (static_cast<size_t>(n) >= sizeof(buf)) {
-        logger(std::string(buf) + " [TRUNCATED]");
-    } else {
-        logger(std::string_view(buf, static_cast<size_t>(n)));
+    sampling_ = true;
+    sampler_ = std::thread{&ProcessMonitor::sample, this};
+}
+
+void ProcessMonitor::stopSampling() {
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+
+        if (!sampling_) {
+            return;
+        }
+
+        sampling_ = false;
     }
+
+    cond_.notify_all();
+    sampler_.join();
+
+    sample_.store(nullptr);
 }
 
-void ProcessMonitor::logTopCpu(LOGGER logger) const {
-    TopProcessInfos topProcessInfos = collectTopInfo(TopInfoType::CPU);
-    TopProcessThreadInfos topProcessThreadInfos;
+void ProcessMonitor::sample() {
+    std::string sharedSnapshot;
+    mode_t sharedSnapshotMode;
+    std::shared_ptr<MetricsExporter> exporter;
+    RECORDER recorder;
+    bool sampleThreads;
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+
+        sharedSnapshot = sharedSnapshot_;
+        sharedSnapshotMode = sharedSnapshotMode_;
+        exporter = exporter_;
+        recorder = recorder_;
+        sampleThreads = sampleThreads_;
+    }
+
+    SharedSnapshotPublisher publisher;
+    SystemInfo_T systemInfo;
+
+    const bool publishing =
+        !sharedSnapshot.empty() &&
+        publisher.open(sharedSnapshot, SharedSnapshotPublisher::kDefaultCapacity, sharedSnapshotMode);
+    const bool systemInfoCollected = (publishing || exporter || recorder) && init_system_info(&systemInfo);
+
+    // Readers of the shared snapshot get the cmdlines of all processes, they are cached from one refresh to the next
+    int pflags = collectFlagsOf(TopInfoType::CPU) | collectFlagsOf(TopInfoType::RAM);
+
+    if (publishing) {
+        pflags |= ProcessTree_CollectCmdline;
+    }
+
+    if (exporter) {
+        pflags |= ProcessTree_CollectCmdline | ProcessTree_CollectIo | ProcessTree_CollectFileDescriptors;
+    }
+
+    if (recorder) {
+        pflags |= ProcessTree_CollectIo | ProcessTree_CollectFileDescriptors;
+    }
+
+    // The process tree of the collector for ALL_PROCESSES, ranked by RAM usage too
+    std::unique_ptr<ProcessCpuCollector> collector;
+    std::unique_ptr<ProcessTreeWrapper> ownTreeWrapper;
 
     if (pid_ == ALL_PROCESSES) {
-        topProcessThreadInfos.resize(topProcessInfos.size());
+        collector = std::make_unique<ProcessCpuCollector>(logCount_, 0, pflags);
+    } else {
+        ownTreeWrapper = std::make_unique<ProcessTreeWrapper>(pid_, pflags);
+    }
+
+    ProcessTreeWrapper &processTreeWrapper = collector ? collector->processTreeWrapper() : *ownTreeWrapper;
+
+    // Walks every thread of the system, only if asked for
+    std::unique_ptr<ThreadCpuCollector> threadCollector;
+
+    if (sampleThreads) {
+        threadCollector = std::make_unique<ThreadCpuCollector>();
+    }
+
+    // Intervals are counted from the start, so the time taken by a refresh does not delay the next one
+    auto next = std::chrono::steady_clock::now() + monitorInterval_;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock{mutex_};
+
+            if (cond_.wait_until(lock, next, [this]() {
+                    return !sampling_;
+                })) {
+                return;
+            }
+        }
+
+        next += monitorInterval_;
+
+        std::shared_ptr<Sample> sample;
+
+        if (collector) {
+            collector->update();
+            sample = std::make_shared<Sample>(
+                Sample{collector->processes(),
+                       collector->threads(),
+                       processTreeWrapper.getTopProcessInfos(TopInfoType::RAM, logCount_),
+                       {},
+                       0});
+        } else {
+            processTreeWrapper.update();
+            sample = std::make_shared<Sample>(Sample{processTreeWrapper.getTopProcessInfos(TopInfoType::CPU, logCount_),
+                                                     {},
+                                                     processTreeWrapper.getTopProcessInfos(TopInfoType::RAM, logCount_),
+                                                     {},
+                                                     0});
+        }
+
+        if (threadCollector) {
+            threadCollector->update();
+            sample->threads = threadCollector->getTopThreadInfos(logCount_);
+            sample->threadsTotal = threadCollector->size();
+        }
+
+        if (systemInfoCollected) {
+            update_system_info(&systemInfo);
+
+            const long long time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                       std::chrono::system_clock::now().time_since_epoch())
+                                       .count();
+
+            if (publishing) {
+                publisher.publish(time, *processTreeWrapper.latest(), systemInfo);
+            }
+
+            if (exporter) {
+                exporter->update(*processTreeWrapper.latest(), systemInfo);
+            }
+
+            if (recorder) {
+                recorder(time, *processTreeWrapper.latest(), systemInfo);
+            }
+        }
+
+        sample_.store(std::move(sample));
+
+        // Only the first sample has waiters, taking the lock orders the store before their check
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+        }
+
+        cond_.notify_all();
+    }
+}
+
+std::shared_ptr<const ProcessMonitor::Sample> ProcessMonitor::latestSample() const {
+    if (std::shared_ptr<const Sample> sample = sample_.load()) {
+        return sample;
+    }
+
+    std::unique_lock<std::mutex> lock{mutex_};
 
-        std::vector<std::thread> threads;
+    cond_.wait(lock, [this]() {
+        return sample_.load() || !sampling_;
+    });
 
-        for (unsigned long i = 0; i < topProcessInfos.size(); i++) {
-            auto &process = topProcessInfos[i];
+    return sample_.load();
+}
 
-            threads.emplace_back([pid = process.pid,
-                                  monitorInterval = monitorInterval_,
-                                  logCount = logCount_,
-                                  &topProcessThreadInfos,
-                                  i]() {
-                ProcessMonitor pm{pid, monitorInterval, logCount};
-                topProcessThreadInfos[i] = pm.collectTopInfo(TopInfoType::CPU);
-            });
+void ProcessMonitor::renderTopCpu(ReportBuilder &report) const {
+    if (sampling()) {
+        if (std::shared_ptr<const Sample> sample = latestSample()) {
+            renderTopCpu(report, sample->cpu, sample->cpuThreads);
+            return;
         }
+    }
+
+    if (pid_ == ALL_PROCESSES) {
+        // The collector and its candidates' thread trees are kept from one report to the next
+        std::lock_guard<std::mutex> lock{collectorMutex_};
 
-        for (auto &t : threads) {
-            t.join();
+        if (cpuCollector_) {
+            cpuCollector_->update();
+        } else {
+            cpuCollector_ = std::make_unique<ProcessCpuCollector>(logCount_);
         }
 
-        formatAndLog(logger, "Top %lu of system processes' CPU usages\n", topProcessInfos.size());
+        std::this_thread::sleep_for(monitorInterval_);
+        cpuCollector_->update();
+
+        renderTopCpu(report, cpuCollector_->processes(), cpuCollector_->threads());
     } else {
-        formatAndLog(logger, "Top %lu of process pid %d's threads' CPU usages\n", topProcessInfos.size(), pid_);
+        renderTopCpu(report, collectTopInfo(TopInfoType::CPU), {});
     }
+}
+
+void ProcessMonitor::renderTopCpu(ReportBuilder &report,
+                                  const TopProcessInfos &topProcessInfos,
+                                  const TopProcessThreadInfos &topProcessThreadInfos) const {
+    if (reportFormat_ == ReportFormat::NDJSON) {
+        renderJson(report, "top_cpu", [&](JsonWriter &writer) {
+            writer.key("pid").value(pid_).key("processes").beginArray();
 
-    logger("------------------------------------------------------------\n");
+            for (unsigned long i = 0; i < topProcessInfos.size(); i++) {
+                writer.beginObject();
+                writeJsonMembers(writer, topProcessInfos[i]);
+
+                if (pid_ == ALL_PROCESSES) {
+                    writer.key("top_threads");
+                    writeJson(writer, topProcessThreadInfos[i]);
+                }
+
+                writer.endObject();
+            }
+
+            writer.endArray();
+        });
+        return;
+    }
+
+    if (pid_ == ALL_PROCESSES) {
+        report.appendf("Top %lu of system processes' CPU usages\n", topProcessInfos.size());
+    } else {
+        report.appendf("Top %lu of process pid %d's threads' CPU usages\n", topProcessInfos.size(), pid_);
+    }
+
+    report.append(kSeparator);
 
     for (unsigned long i = 0; i < topProcessInfos.size(); i++) {
-        formatAndLog(logger,
-                     "%d  %.1f%%  %s\n",
-                     topProcessInfos[i].pid,
-                     topProcessInfos[i].cpuUsage,
-                     topProcessInfos[i].cmdline.c_str());
+        report.appendf("%d  %.1f%%  %s\n",
+                       topProcessInfos[i].pid,
+                       topProcessInfos[i].cpuUsage,
+                       topProcessInfos[i].cmdline.c_str());
 
-        logger("------------------------------------------------------------\n");
+        report.append(kSeparator);
 
         if (pid_ == ALL_PROCESSES) {
             for (auto &thread : topProcessThreadInfos[i]) {
-                formatAndLog(logger, "%d  %.1f%%  %s\n", thread.pid, thread.cpuUsage, thread.cmdline.c_str());
+                report.appendf("%d  %.1f%%  %s\n", thread.pid, thread.cpuUsage, thread.cmdline.c_str());
             }
 
-            logger("------------------------------------------------------------\n");
+            report.append(kSeparator);
         }
     }
 
-    logger("\n");
+    report.append("\n");
 }
 
-void ProcessMonitor::logTopRam(LOGGER logger) const {
-    TopProcessInfos topProcessInfos = collectTopInfo(TopInfoType::RAM);
+void ProcessMonitor::renderTopRam(ReportBuilder &report) const {
+    if (sampling()) {
+        if (std::shared_ptr<const Sample> sample = latestSample()) {
+            renderTopRam(report, sample->ram);
+            return;
+        }
+    }
+
+    renderTopRam(report, collectTopInfo(TopInfoType::RAM));
+}
+
+void ProcessMonitor::renderTopRam(ReportBuilder &report, const TopProcessInfos &topProcessInfos) const {
+    if (reportFormat_ == ReportFormat::NDJSON) {
+        renderJson(report, "top_ram", [&](JsonWriter &writer) {
+            writer.key("pid").value(pid_).key("memory_size").value(g_fixed_system_info.memory_size);
+            writer.key("processes").beginArray();
+
+            // The process itself only, as in text
+            for (unsigned long i = 0; i < topProcessInfos.size() && (pid_ == ALL_PROCESSES || i < 1); i++) {
+                writeJson(writer, topProcessInfos[i]);
+            }
+
+            writer.endArray();
+        });
+        return;
+    }
 
     if (pid_ == ALL_PROCESSES) {
-        formatAndLog(logger,
-                     "Top %lu processes' RAM usages (total %.1f MiB)\n",
-                     topProcessInfos.size(),
-                     static_cast<double>(g_fixed_system_info.memory_size) / (1024 * 1024));
+        report.appendf("Top %lu processes' RAM usages (total %.1f MiB)\n",
+                       topProcessInfos.size(),
+                       static_cast<double>(g_fixed_system_info.memory_size) / (1024 * 1024));
     } else {
-        formatAndLog(logger,
-                     "Process pid %d's RAM usage (total %.1f MiB)\n",
-                     pid_,
-                     static_cast<double>(g_fixed_system_info.memory_size) / (1024.0 * 1024.0));
+        report.appendf("Process pid %d's RAM usage (total %.1f MiB)\n",
+                       pid_,
+                       static_cast<double>(g_fixed_system_info.memory_size) / (1024.0 * 1024.0));
     }
 
-    logger("------------------------------------------------------------\n");
+    report.append(kSeparator);
 
     for (unsigned long i = 0; i < topProcessInfos.size(); i++) {
         if (pid_ != ALL_PROCESSES && i == 1) {
             break;
         }
 
-        formatAndLog(logger,
-                     "%d  %.1f MiB  %s\n",
-                     topProcessInfos[i].pid,
-                     static_cast<double>(topProcessInfos[i].ramUsage) / (1024 * 1024),
-                     topProcessInfos[i].cmdline.c_str());
+        report.appendf("%d  %.1f MiB  %s\n",
+                       topProcessInfos[i].pid,
+                       static_cast<double>(topProcessInfos[i].ramUsage) / (1024 * 1024),
+                       topProcessInfos[i].cmdline.c_str());
+
+        report.append(kSeparator);
+    }
+
+    report.append("\n");
+}
+
+void ProcessMonitor::renderTopThreads(ReportBuilder &report) const {
+    if (sampling()) {
+        if (std::shared_ptr<const Sample> sample = latestSample(); sample && sample->threadsTotal > 0) {
+            renderTopThreads(report, sample->threads, sample->threadsTotal);
+            return;
+        }
+    }
+
+    ThreadCpuCollector collector;
+
+    std::this_thread::sleep_for(monitorInterval_);
+    collector.update();
+
+    renderTopThreads(report, collector.getTopThreadInfos(logCount_), collector.size());
+}
+
+void ProcessMonitor::renderTopThreads(ReportBuilder &report,
+                                      const TopThreadInfos &topThreadInfos,
+                                      size_t threadsTotal) const {
+    if (reportFormat_ == ReportFormat::NDJSON) {
+        renderJson(report, "top_threads", [&](JsonWriter &writer) {
+            writer.key("threads_total").value(threadsTotal).key("threads").beginArray();
+
+            for (const ThreadInfo &thread : topThreadInfos) {
+                writer.beginObject()
+                    .key("tid")
+                    .value(thread.tid)
+                    .key("pid")
+                    .value(thread.pid)
+                    .key("cpu_usage")
+                    .value(thread.cpuUsage)
+                    .key("comm")
+                    .value(thread.comm)
+                    .endObject();
+            }
+
+            writer.endArray();
+        });
+        return;
+    }
+
+    report.appendf("Top %lu of system threads' CPU usages (%lu threads)\n", topThreadInfos.size(), threadsTotal);
+    report.append(kSeparator);
 
-        logger("------------------------------------------------------------\n");
+    for (const ThreadInfo &thread : topThreadInfos) {
+        report.appendf("%d  %.1f%%  %s  (pid %d)\n", thread.tid, thread.cpuUsage, thread.comm.c_str(), thread.pid);
     }
 
-    logger("\n");
+    report.append(kSeparator);
+    report.append("\n");
 }
 
 }  // namespace simple_process_monitor
@@ -1,71 +1,171 @@
 #include <simple_process_monitor/process_tree_wrapper.h>
 
-#include <queue>
+#include <algorithm>
+#include <cstring>
+
+#include <simple_process_monitor/top_k.h>
 
 namespace simple_process_monitor {
 
-TopProcessInfos ProcessTreeWrapper::getTopProcessInfos(TopInfoType type, int count) const {
-    if (treeSize_ <= 0) {
+// Skip the virtual root
+static bool isProcess(const ProcessTree_T &p) {
+    return p.pid > 0;
+}
+
+std::vector<pid_t> ProcessTreeWrapper::getPids() const {
+    std::vector<pid_t> pids;
+
+    pids.reserve(static_cast<size_t>(std::max(treeSize_, 0)));
+
+    for (int i = 0; i < treeSize_; i++) {
+        if (isProcess(pTree_[i])) {
+            pids.push_back(pTree_[i].pid);
+        }
+    }
+
+    return pids;
+}
+
+static std::vector<const ProcessTree_T *> rank(const ProcessTree_T *pTree, int treeSize, TopInfoType type, int count) {
+    if (treeSize <= 0 || count <= 0) {
         return {};
     }
 
-    if (type == TopInfoType::CPU) {
-        auto processCpuCompare = [](const ProcessTree_T *p1, const ProcessTree_T *p2) {
-            return p1->cpu.usage.self < p2->cpu.usage.self;
-        };
+    const auto k = static_cast<size_t>(count);
+
+    switch (type) {
+        case TopInfoType::CPU:
+            return topK<ProcessCpuUsage>(pTree, pTree + treeSize, k, isProcess);
+        case TopInfoType::RAM:
+            return topK<ProcessRamUsage>(pTree, pTree + treeSize, k, isProcess);
+        case TopInfoType::IO:
+            return topK<ProcessIoBytes>(pTree, pTree + treeSize, k, isProcess);
+        case TopInfoType::FILE_DESCRIPTORS:
+            return topK<ProcessFileDescriptors>(pTree, pTree + treeSize, k, isProcess);
+        case TopInfoType::THREADS:
+            return topK<ProcessThreads>(pTree, pTree + treeSize, k, isProcess);
+    }
 
-        using ProcessCpuPQ =
-            std::priority_queue<const ProcessTree_T *, std::vector<const ProcessTree_T *>, decltype(processCpuCompare)>;
+    return {};
+}
 
-        ProcessCpuPQ pq{processCpuCompare};
+static ProcessOrThreadInfo toProcessInfo(const ProcessTree_T &process) {
+    return ProcessOrThreadInfo{process.pid,
+                               process.threads.self,
+                               process.cpu.usage.self,
+                               process.memory.usage,
+                               process.cmdline ? process.cmdline : process.comm,
+                               process.read.bytes + process.write.bytes,
+                               process.filedescriptors.usage};
+}
 
-        return getTopProcessInfos(pq, count);
+ProcessTreeSnapshot::ProcessTreeSnapshot(const ProcessTree_T *pTree, int treeSize)
+    : tree_(pTree, pTree + treeSize)
+    , pTree_(tree_.data())
+    , treeSize_(treeSize) {
+    size_t children = 0;
+    size_t strings = 0;
+
+    for (const ProcessTree_T &process : tree_) {
+        children += static_cast<size_t>(process.children.count);
+        strings += process.cmdline ? strlen(process.cmdline) + 1 : 0;
+        strings += process.secattr ? strlen(process.secattr) + 1 : 0;
     }
 
-    if (type == TopInfoType::RAM) {
-        auto processRamCompare = [](const ProcessTree_T *p1, const ProcessTree_T *p2) {
-            return p1->memory.usage < p2->memory.usage;
-        };
+    children_.resize(children);
+    strings_.resize(strings);
 
-        using ProcessRamPQ =
-            std::priority_queue<const ProcessTree_T *, std::vector<const ProcessTree_T *>, decltype(processRamCompare)>;
+    // The pointers into the arena are moved to the copies
+    int *child = children_.data();
+    char *string = strings_.data();
 
-        ProcessRamPQ pq{processRamCompare};
+    const auto copyString = [&string](char *&s) {
+        if (s) {
+            const size_t size = strlen(s) + 1;
 
-        return getTopProcessInfos(pq, count);
+            memcpy(string, s, size);
+            s = string;
+            string += size;
+        }
+    };
+
+    for (ProcessTree_T &process : tree_) {
+        if (process.children.count) {
+            memcpy(child, process.children.list, sizeof(int) * static_cast<size_t>(process.children.count));
+            process.children.list = child;
+            child += process.children.count;
+        }
+
+        copyString(process.cmdline);
+        copyString(process.secattr);
     }
+}
 
-    return {};
+TopProcessInfos ProcessTreeSnapshot::getTopProcessInfos(TopInfoType type, int count) const {
+    TopProcessInfos ret;
+
+    for (const ProcessTree_T *pProcess : rank(pTree_, treeSize_, type, count)) {
+        ret.push_back(toProcessInfo(*pProcess));
+    }
+
+    return ret;
 }
 
-template <typename T>
-TopProcessInfos ProcessTreeWrapper::getTopProcessInfos(T &maxPQ, int count) const {
-    std::vector<ProcessOrThreadInfo> ret;
+TopProcessInfos ProcessTreeWrapper::getTopProcessInfos(TopInfoType type, int count) {
+    return toTopProcessInfos(rank(pTree_, treeSize_, type, count));
+}
+
+TopProcessInfoRankings ProcessTreeWrapper::getTopProcessInfoRankings(int count) {
+    if (treeSize_ <= 0 || count <= 0) {
+        return {};
+    }
+
+    const auto k = static_cast<size_t>(std::min(count, treeSize_));
+
+    TopK<ProcessTree_T, ProcessCpuUsage> cpu{k};
+    TopK<ProcessTree_T, ProcessRamUsage> ram{k};
+    TopK<ProcessTree_T, ProcessIoBytes> io{k};
+    TopK<ProcessTree_T, ProcessFileDescriptors> fileDescriptors{k};
+    TopK<ProcessTree_T, ProcessThreads> threads{k};
 
     for (int i = 0; i < treeSize_; i++) {
-        // Skip the virtual root
-        if (pTree_[i].pid > 0) {
-            maxPQ.push(&pTree_[i]);
+        if (isProcess(pTree_[i])) {
+            cpu.push(pTree_[i]);
+            ram.push(pTree_[i]);
+            io.push(pTree_[i]);
+            fileDescriptors.push(pTree_[i]);
+            threads.push(pTree_[i]);
         }
     }
 
-    count = std::min(treeSize_, count);
+    TopProcessInfoRankings rankings;
 
-    for (int i = 0; i < count; i++) {
-        const ProcessTree_T *pProcess = maxPQ.top();
+    rankings[static_cast<size_t>(TopInfoType::CPU)] = toTopProcessInfos(cpu.take());
+    rankings[static_cast<size_t>(TopInfoType::RAM)] = toTopProcessInfos(ram.take());
+    rankings[static_cast<size_t>(TopInfoType::IO)] = toTopProcessInfos(io.take());
+    rankings[static_cast<size_t>(TopInfoType::FILE_DESCRIPTORS)] = toTopProcessInfos(fileDescriptors.take());
+    rankings[static_cast<size_t>(TopInfoType::THREADS)] = toTopProcessInfos(threads.take());
 
-        if (pProcess->cmdline) {
-            ret.emplace_back(pProcess->pid,
-                             pProcess->threads.self,
-                             pProcess->cpu.usage.self,
-                             pProcess->memory.usage,
-                             pProcess->cmdline);
+    return rankings;
+}
+
+TopProcessInfos ProcessTreeWrapper::toTopProcessInfos(const std::vector<const ProcessTree_T *> &top) {
+    std::vector<ProcessOrThreadInfo> ret;
+
+    ret.reserve(top.size());
+
+    for (const ProcessTree_T *pProcess : top) {
+        // Only the returned processes need a cmdline, the rest of the tree was ranked without reading it. It is
+        // collected into a copy, the tree is published and must not change. The cmdline is cached per process, so a
+        // process in several top lists reads it once. The cmdline of a thread is its name, the tree has it already.
+        if (pid_ == ALL_PROCESSES && !(pflags_ & ProcessTree_CollectCmdline) && !pProcess->cmdline) {
+            ProcessTree_T process = *pProcess;
+
+            ProcessTree_collect(&process, 1, context_.get(), 0, ProcessTree_CollectCmdline);
+            ret.push_back(toProcessInfo(process));
         } else {
-            ret.emplace_back(
-                pProcess->pid, pProcess->threads.self, pProcess->cpu.usage.self, pProcess->memory.usage, "(null)");
+            ret.push_back(toProcessInfo(*pProcess));
         }
-
-        maxPQ.pop();
     }
 
     return ret;
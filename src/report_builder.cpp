@@ -0,0 +1,40 @@
+#include <simple_process_monitor/report_builder.h>
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+
+namespace simple_process_monitor {
+
+void ReportBuilder::appendf(const char *fmt, ...) {
+    static constexpr size_t kMinSpare = 256;
+
+    const size_t size = buffer_.size();
+
+    // Format in place into the spare capacity, growing it once if the line does not fit
+    buffer_.resize(std::max(buffer_.capacity(), size + kMinSpare));
+
+    va_list ap;
+
+    va_start(ap, fmt);
+    const int n = std::vsnprintf(&buffer_[size], buffer_.size() - size + 1, fmt, ap);
+    va_end(ap);
+
+    if (n < 0) {
+        buffer_.resize(size);
+        buffer_ += "appendf: vsnprintf formatting error\n";
+        return;
+    }
+
+    if (static_cast<size_t>(n) > buffer_.size() - size) {
+        buffer_.resize(size + static_cast<size_t>(n));
+
+        va_start(ap, fmt);
+        std::vsnprintf(&buffer_[size], static_cast<size_t>(n) + 1, fmt, ap);
+        va_end(ap);
+    }
+
+    buffer_.resize(size + static_cast<size_t>(n));
+}
+
+}  // namespace simple_process_monitor
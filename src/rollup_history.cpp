@@ -0,0 +1,188 @@
+#include <simple_process_monitor/rollup_history.h>
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace simple_process_monitor {
+
+const std::vector<RollupTier> &defaultRollupTiers() {
+    static const std::vector<RollupTier> tiers{{60 * 1000LL, 24 * 60}, {3600 * 1000LL, 4 * 7 * 24}};
+
+    return tiers;
+}
+
+// Start of the interval of time, rounding down negative times too
+static long long intervalOf(long long time, long long resolution) {
+    const long long q = time / resolution;
+
+    return (q - (time % resolution < 0 ? 1 : 0)) * resolution;
+}
+
+static void addToRollup(Rollup &rollup, const HistoryValues &values) {
+    rollup.count++;
+
+    for (size_t i = 0; i < kHistoryMetricCount; i++) {
+        // Unknown
+        if (values[i] < 0) {
+            continue;
+        }
+
+        if (rollup.counts[i]++ == 0) {
+            rollup.min[i] = rollup.max[i] = rollup.sum[i] = values[i];
+        } else {
+            rollup.min[i] = std::min(rollup.min[i], values[i]);
+            rollup.max[i] = std::max(rollup.max[i], values[i]);
+            rollup.sum[i] += values[i];
+        }
+
+        rollup.last[i] = values[i];
+    }
+}
+
+static Rollup startRollup(long long time, const HistoryValues &values) {
+    HistoryValues unknown;
+
+    unknown.fill(-1.);
+
+    Rollup rollup{time, 0, {}, unknown, unknown, HistoryValues{}, unknown};
+
+    addToRollup(rollup, values);
+
+    return rollup;
+}
+
+RollupSeries::RollupSeries(const std::vector<RollupTier> &tiers) {
+    assert(!tiers.empty());
+
+    tiers_.reserve(tiers.size());
+
+    for (const RollupTier &tier : tiers) {
+        assert(tier.resolution > 0 && tier.rollups > 0);
+        assert(tiers_.empty() || tier.resolution > tiers_.back().resolution);
+
+        tiers_.push_back(Tier{tier.resolution, tier.rollups, {}, Rollup{}, false});
+    }
+}
+
+void RollupSeries::push(long long time, const HistoryValues &values) {
+    for (Tier &tier : tiers_) {
+        const long long interval = intervalOf(time, tier.resolution);
+
+        if (tier.open.count > 0 && tier.open.time == interval) {
+            addToRollup(tier.open, values);
+            continue;
+        }
+
+        assert(tier.open.count == 0 || interval > tier.open.time);
+
+        if (tier.open.count > 0) {
+            if (tier.closed.size() == tier.capacity) {
+                tier.closed.pop_front();
+                tier.dropped = true;
+            }
+
+            tier.closed.push_back(tier.open);
+        }
+
+        tier.open = startRollup(interval, values);
+    }
+}
+
+bool RollupSeries::covers(const Tier &tier, long long time) {
+    if (!tier.dropped) {
+        return true;
+    }
+
+    return (tier.closed.empty() ? tier.open.time : tier.closed.front().time) <= time;
+}
+
+size_t RollupSeries::tierOf(long long resolution, long long from) const {
+    size_t tier = 0;
+
+    while (tier + 1 < tiers_.size() && tiers_[tier + 1].resolution <= resolution) {
+        tier++;
+    }
+
+    // Coarser tiers span more time
+    while (tier + 1 < tiers_.size() && !covers(tiers_[tier], from)) {
+        tier++;
+    }
+
+    return tier;
+}
+
+std::vector<Rollup> RollupSeries::query(long long from, long long to, long long resolution) const {
+    const Tier &tier = tiers_[tierOf(resolution, from)];
+
+    // The intervals starting in [from rounded down, to)
+    const long long first = intervalOf(from, tier.resolution);
+
+    auto begin = std::lower_bound(tier.closed.begin(), tier.closed.end(), first, [](const Rollup &r, long long t) {
+        return r.time < t;
+    });
+    auto end = std::lower_bound(begin, tier.closed.end(), to, [](const Rollup &r, long long t) {
+        return r.time < t;
+    });
+
+    std::vector<Rollup> rollups{begin, end};
+
+    if (tier.open.count > 0 && tier.open.time >= first && tier.open.time < to) {
+        rollups.push_back(tier.open);
+    }
+
+    return rollups;
+}
+
+size_t RollupSeries::bytes() const {
+    size_t bytes = 0;
+
+    for (const Tier &tier : tiers_) {
+        bytes += sizeof(Tier) + tier.closed.size() * sizeof(Rollup);
+    }
+
+    return bytes;
+}
+
+RollupHistory::RollupHistory(std::vector<RollupTier> tiers)
+    : tiers_(std::move(tiers))
+    , system_(tiers_) {}
+
+void RollupHistory::record(long long time, const ProcessTreeSnapshot &snapshot) {
+    series_.evict(snapshot);
+
+    for (const ProcessTree_T &p : snapshot) {
+        // Skip the virtual root
+        if (p.pid <= 0) {
+            continue;
+        }
+
+        RollupSeries *series = series_.find(p);
+
+        if (!series) {
+            series = &series_.track(p, RollupSeries{tiers_});
+        }
+
+        series->push(time, historyValuesOf(p));
+    }
+}
+
+void RollupHistory::record(long long time, const SystemInfo_T &systemInfo) {
+    system_.push(time, historyValuesOf(systemInfo));
+}
+
+const RollupSeries *RollupHistory::process(pid_t pid) const {
+    return series_.find(pid);
+}
+
+size_t RollupHistory::bytes() const {
+    size_t bytes = system_.bytes();
+
+    for (const auto &[pid, tracked] : series_) {
+        bytes += tracked.series.bytes();
+    }
+
+    return bytes;
+}
+
+}  // namespace simple_process_monitor
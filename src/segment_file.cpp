@@ -0,0 +1,396 @@
+#include <simple_process_monitor/segment_file.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace simple_process_monitor {
+
+static const char kSegmentMagic[8] = {'S', 'P', 'M', 'S', 'E', 'G', '\0', '\0'};
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~static_cast<size_t>(7);
+}
+
+static bool validHeader(const char *data, size_t size) {
+    if (size < sizeof(SegmentHeader)) {
+        return false;
+    }
+
+    SegmentHeader header;
+
+    std::memcpy(&header, data, sizeof(header));
+
+    return std::memcmp(header.magic, kSegmentMagic, sizeof(kSegmentMagic)) == 0 && header.version == kSegmentVersion &&
+           header.rowSize == sizeof(SegmentRow);
+}
+
+// Size of the block at offset, 0 if there is no complete block
+static size_t blockSize(const char *data, size_t size, uint64_t offset) {
+    if (offset % 8 != 0 || offset > size || size - offset < sizeof(SegmentBlock)) {
+        return 0;
+    }
+
+    const auto *block = reinterpret_cast<const SegmentBlock *>(data + offset);
+
+    if (block->magic != kSegmentBlockMagic) {
+        return 0;
+    }
+
+    const size_t strings = sizeof(SegmentBlock) + size_t{block->rows} * sizeof(SegmentRow);
+    const size_t n = align8(strings + block->stringBytes);
+
+    // The last string ends in the table, so no string is read past the block
+    if (n > size - offset || (block->stringBytes > 0 && data[offset + strings + block->stringBytes - 1] != '\0')) {
+        return 0;
+    }
+
+    return n;
+}
+
+// The index of a segment from its footer, or by walking the blocks if it has none. Sets *end to the end of the blocks.
+// false if the footer indexes blocks which are not complete blocks in file order, the segment is corrupt.
+static bool readIndex(const char *data, size_t size, std::vector<SegmentIndexEntry> &index, uint64_t *end) {
+    index.clear();
+
+    if (size >= sizeof(SegmentHeader) + sizeof(SegmentFooter)) {
+        const auto *footer = reinterpret_cast<const SegmentFooter *>(data + size - sizeof(SegmentFooter));
+
+        const uint64_t indexEnd = size - sizeof(SegmentFooter);
+
+        // The bounds are checked before the sum, which a corrupt footer could make wrap around
+        if (footer->magic == kSegmentFooterMagic && footer->index >= sizeof(SegmentHeader) && footer->index % 8 == 0 &&
+            footer->index <= indexEnd && footer->entries <= (indexEnd - footer->index) / sizeof(SegmentIndexEntry) &&
+            footer->index + uint64_t{footer->entries} * sizeof(SegmentIndexEntry) == indexEnd) {
+            const auto *entries = reinterpret_cast<const SegmentIndexEntry *>(data + footer->index);
+
+            index.assign(entries, entries + footer->entries);
+
+            // Every entry is a whole block before the index, after the previous one and not older
+            uint64_t next = sizeof(SegmentHeader);
+
+            for (size_t i = 0; i < index.size(); i++) {
+                const uint64_t offset = index[i].offset;
+                const size_t n = offset >= next ? blockSize(data, footer->index, offset) : 0;
+
+                if (n == 0 || reinterpret_cast<const SegmentBlock *>(data + offset)->time != index[i].time ||
+                    (i > 0 && index[i].time < index[i - 1].time)) {
+                    index.clear();
+                    return false;
+                }
+
+                next = offset + n;
+            }
+
+            *end = footer->index;
+
+            return true;
+        }
+    }
+
+    uint64_t offset = sizeof(SegmentHeader);
+
+    while (const size_t n = blockSize(data, size, offset)) {
+        index.push_back(SegmentIndexEntry{reinterpret_cast<const SegmentBlock *>(data + offset)->time, offset});
+        offset += n;
+    }
+
+    *end = offset;
+
+    return true;
+}
+
+static bool writeAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = ::write(fd, data, size);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+static uint32_t addString(std::vector<char> &strings, const char *s) {
+    if (!s) {
+        return kSegmentNoString;
+    }
+
+    const auto offset = static_cast<uint32_t>(strings.size());
+
+    strings.insert(strings.end(), s, s + std::strlen(s) + 1);
+
+    return offset;
+}
+
+static SegmentRow toSegmentRow(const ProcessTree_T &p, std::vector<char> &strings) {
+    SegmentRow row{};
+
+    row.pid = p.pid;
+    row.ppid = p.ppid;
+    row.parent = p.parent;
+    row.threads = p.threads.self;
+    row.threadsChildren = p.threads.children;
+    row.children = p.children.total;
+    row.uid = p.cred.uid;
+    row.euid = p.cred.euid;
+    row.gid = p.cred.gid;
+    row.processor = p.processor;
+    row.cpuUsage = p.cpu.usage.self;
+    row.cpuUsageChildren = p.cpu.usage.children;
+    row.cpuTime = p.cpu.time;
+    row.memory = p.memory.usage;
+    row.memoryTotal = p.memory.usage_total;
+    row.faultsMinor = p.faults.minor;
+    row.faultsMajor = p.faults.major;
+    row.priority = p.priority;
+    row.nice = p.nice;
+    row.readBytes = p.read.bytes;
+    row.readOperations = p.read.operations;
+    row.writeBytes = p.write.bytes;
+    row.writeOperations = p.write.operations;
+    row.fileDescriptors = p.filedescriptors.usage;
+    row.fileDescriptorsTotal = p.filedescriptors.usage_total;
+    row.uptime = p.uptime;
+    row.cmdline = addString(strings, p.cmdline);
+    row.secattr = addString(strings, p.secattr);
+    row.zombie = p.zombie;
+
+    return row;
+}
+
+bool SegmentWriter::open(const std::string &path) {
+    close();
+
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    const auto size = static_cast<size_t>(st.st_size);
+
+    if (size == 0) {
+        SegmentHeader header{};
+
+        std::memcpy(header.magic, kSegmentMagic, sizeof(kSegmentMagic));
+        header.version = kSegmentVersion;
+        header.rowSize = sizeof(SegmentRow);
+
+        if (!writeAll(fd, reinterpret_cast<const char *>(&header), sizeof(header))) {
+            ::close(fd);
+            return false;
+        }
+
+        size_ = sizeof(header);
+    } else {
+        void *data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+
+        const bool valid = validHeader(static_cast<const char *>(data), size) &&
+                           readIndex(static_cast<const char *>(data), size, index_, &size_);
+
+        ::munmap(data, size);
+
+        // Appending overwrites the footer or a partially written block
+        if (!valid || ::ftruncate(fd, static_cast<off_t>(size_)) != 0 ||
+            ::lseek(fd, static_cast<off_t>(size_), SEEK_SET) < 0) {
+            if (!valid) {
+                errno = EINVAL;
+            }
+
+            index_.clear();
+            ::close(fd);
+            return false;
+        }
+    }
+
+    fd_ = fd;
+
+    return true;
+}
+
+bool SegmentWriter::append(long long time, const ProcessTreeSnapshot &snapshot) {
+    if (failed_) {
+        errno = EIO;
+        return false;
+    }
+
+    if (fd_ < 0 || (!index_.empty() && time < index_.back().time)) {
+        errno = EINVAL;
+        return false;
+    }
+
+    strings_.clear();
+    buffer_.resize(sizeof(SegmentBlock) + static_cast<size_t>(snapshot.size()) * sizeof(SegmentRow));
+
+    auto *rows = reinterpret_cast<SegmentRow *>(buffer_.data() + sizeof(SegmentBlock));
+
+    for (const ProcessTree_T &p : snapshot) {
+        *rows++ = toSegmentRow(p, strings_);
+    }
+
+    const SegmentBlock block{kSegmentBlockMagic,
+                             static_cast<uint32_t>(snapshot.size()),
+                             time,
+                             static_cast<uint32_t>(strings_.size()),
+                             0};
+
+    std::memcpy(buffer_.data(), &block, sizeof(block));
+    buffer_.insert(buffer_.end(), strings_.begin(), strings_.end());
+    buffer_.resize(align8(buffer_.size()));
+
+    // A partially written block is cut off, so the next block follows the last complete one. If that fails too the
+    // file ends with garbage, which the next open cuts off, and nothing more is appended until then.
+    if (!writeAll(fd_, buffer_.data(), buffer_.size())) {
+        const int error = errno;
+
+        failed_ = ::ftruncate(fd_, static_cast<off_t>(size_)) != 0 ||
+                  ::lseek(fd_, static_cast<off_t>(size_), SEEK_SET) < 0;
+        errno = error;
+        return false;
+    }
+
+    index_.push_back(SegmentIndexEntry{time, size_});
+    size_ += buffer_.size();
+
+    return true;
+}
+
+bool SegmentWriter::close() {
+    if (fd_ < 0) {
+        return true;
+    }
+
+    // A footer after garbage would index it, the next open walks the blocks instead
+    if (failed_) {
+        ::close(fd_);
+        fd_ = -1;
+        size_ = 0;
+        index_.clear();
+        failed_ = false;
+        errno = EIO;
+        return false;
+    }
+
+    const SegmentFooter footer{size_, static_cast<uint32_t>(index_.size()), kSegmentFooterMagic};
+
+    bool ok = writeAll(fd_, reinterpret_cast<const char *>(index_.data()), index_.size() * sizeof(SegmentIndexEntry)) &&
+              writeAll(fd_, reinterpret_cast<const char *>(&footer), sizeof(footer));
+
+    ok = ::close(fd_) == 0 && ok;
+
+    fd_ = -1;
+    size_ = 0;
+    index_.clear();
+
+    return ok;
+}
+
+bool SegmentReader::open(const std::string &path) {
+    close();
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    const auto size = static_cast<size_t>(st.st_size);
+    void *data = size > 0 ? ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+
+    ::close(fd);
+
+    if (data == MAP_FAILED) {
+        if (size == 0) {
+            errno = EINVAL;
+        }
+
+        return false;
+    }
+
+    if (!validHeader(static_cast<const char *>(data), size)) {
+        ::munmap(data, size);
+        errno = EINVAL;
+        return false;
+    }
+
+    uint64_t end;
+
+    if (!readIndex(static_cast<const char *>(data), size, index_, &end)) {
+        ::munmap(data, size);
+        errno = EINVAL;
+        return false;
+    }
+
+    data_ = static_cast<const char *>(data);
+    size_ = size;
+
+    return true;
+}
+
+void SegmentReader::close() {
+    if (data_) {
+        ::munmap(const_cast<char *>(data_), size_);
+    }
+
+    data_ = nullptr;
+    size_ = 0;
+    index_.clear();
+}
+
+const SegmentRow *SegmentReader::rows(size_t block, size_t *count) const {
+    *count = this->block(block)->rows;
+
+    return reinterpret_cast<const SegmentRow *>(data_ + index_[block].offset + sizeof(SegmentBlock));
+}
+
+const char *SegmentReader::string(size_t block, uint32_t offset) const {
+    const SegmentBlock *b = this->block(block);
+
+    if (offset == kSegmentNoString || offset >= b->stringBytes) {
+        return nullptr;
+    }
+
+    return reinterpret_cast<const char *>(b + 1) + size_t{b->rows} * sizeof(SegmentRow) + offset;
+}
+
+size_t SegmentReader::find(long long time) const {
+    auto it = std::upper_bound(index_.begin(), index_.end(), time, [](long long t, const SegmentIndexEntry &entry) {
+        return t < entry.time;
+    });
+
+    return it == index_.begin() ? index_.size() : static_cast<size_t>(it - index_.begin()) - 1;
+}
+
+}  // namespace simple_process_monitor
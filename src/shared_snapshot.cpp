@@ -0,0 +1,274 @@
+#include <simple_process_monitor/shared_snapshot.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <thread>
+
+namespace simple_process_monitor {
+
+static const char kSharedSnapshotMagic[8] = {'S', 'P', 'M', 'S', 'H', 'M', '\0', '\0'};
+
+static size_t segmentSize(size_t capacity) {
+    return sizeof(SharedSnapshotHeader) + capacity * sizeof(SharedProcess);
+}
+
+static const SharedProcess *processesOf(const SharedSnapshotHeader *header) {
+    return reinterpret_cast<const SharedProcess *>(header + 1);
+}
+
+// A header written by a publisher of this layout, in a segment of size bytes
+static bool compatible(const SharedSnapshotHeader *header, size_t size) {
+    return size >= sizeof(SharedSnapshotHeader) &&
+           std::memcmp(header->magic, kSharedSnapshotMagic, sizeof(kSharedSnapshotMagic)) == 0 &&
+           header->version == kSharedSnapshotVersion && header->headerSize == sizeof(SharedSnapshotHeader) &&
+           header->processSize == sizeof(SharedProcess) && size >= segmentSize(header->capacity);
+}
+
+static SharedProcess toSharedProcess(const ProcessTree_T &p) {
+    SharedProcess process{};
+
+    process.pid = p.pid;
+    process.ppid = p.ppid;
+    process.threads = p.threads.self;
+    process.uid = p.cred.uid;
+    process.cpuUsage = p.cpu.usage.self;
+    process.memory = p.memory.usage;
+    process.ioBytes = p.read.bytes + p.write.bytes;
+    process.fileDescriptors = p.filedescriptors.usage;
+    process.uptime = p.uptime;
+
+    if (p.cmdline) {
+        std::strncpy(process.cmdline, p.cmdline, sizeof(process.cmdline) - 1);
+    }
+
+    return process;
+}
+
+bool SharedSnapshotPublisher::open(const std::string &name, size_t capacity, mode_t mode) {
+    close();
+
+    const size_t size = segmentSize(capacity);
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, mode);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+
+    // The mode is set whatever the umask or the mode of a segment taken over
+    if (::fchmod(fd, mode) != 0 || ::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void *data = MAP_FAILED;
+
+    // Take over the segment of a previous publisher if it has the same layout, else replace it. Readers of a replaced
+    // segment keep reading the old one until they open the name again.
+    if (static_cast<size_t>(st.st_size) == size) {
+        data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (data != MAP_FAILED && !compatible(static_cast<const SharedSnapshotHeader *>(data), size)) {
+            ::munmap(data, size);
+            data = MAP_FAILED;
+        }
+    }
+
+    if (data == MAP_FAILED) {
+        ::close(fd);
+        ::shm_unlink(name.c_str());
+
+        fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+
+        if (fd < 0) {
+            return false;
+        }
+
+        if (::fchmod(fd, mode) != 0 || ::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            ::close(fd);
+            return false;
+        }
+
+        data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+
+        // The new segment is zero-filled, a reader sees no snapshot until the first publish
+        auto *header = new (data) SharedSnapshotHeader{};
+
+        header->version = kSharedSnapshotVersion;
+        header->headerSize = sizeof(SharedSnapshotHeader);
+        header->processSize = sizeof(SharedProcess);
+        header->capacity = static_cast<uint32_t>(capacity);
+
+        // Readers check the magic last
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(header->magic, kSharedSnapshotMagic, sizeof(kSharedSnapshotMagic));
+    }
+
+    ::close(fd);
+
+    header_ = static_cast<SharedSnapshotHeader *>(data);
+    size_ = size;
+
+    return true;
+}
+
+void SharedSnapshotPublisher::close() {
+    if (header_) {
+        ::munmap(header_, size_);
+    }
+
+    header_ = nullptr;
+    size_ = 0;
+}
+
+void SharedSnapshotPublisher::publish(long long time,
+                                      const ProcessTreeSnapshot &snapshot,
+                                      const SystemInfo_T &systemInfo) {
+    if (!header_) {
+        return;
+    }
+
+    // Odd while writing, a previous publisher may have died with an odd sequence
+    const uint32_t sequence = header_->sequence.load(std::memory_order_relaxed) | 1;
+
+    header_->sequence.store(sequence, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto *processes = reinterpret_cast<SharedProcess *>(header_ + 1);
+    uint32_t count = 0;
+    uint32_t total = 0;
+
+    for (const ProcessTree_T &p : snapshot) {
+        // Skip the virtual root
+        if (p.pid <= 0) {
+            continue;
+        }
+
+        if (count < header_->capacity) {
+            processes[count++] = toSharedProcess(p);
+        }
+
+        total++;
+    }
+
+    header_->processes = count;
+    header_->total = total;
+    header_->time = time;
+    header_->system = systemInfo;
+
+    header_->sequence.store(sequence + 1, std::memory_order_release);
+}
+
+bool SharedSnapshotPublisher::remove(const std::string &name) {
+    return ::shm_unlink(name.c_str()) == 0;
+}
+
+bool SharedSnapshotReader::open(const std::string &name) {
+    close();
+
+    const int fd = ::shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    const auto size = static_cast<size_t>(st.st_size);
+    void *data = size > 0 ? ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+
+    ::close(fd);
+
+    if (data == MAP_FAILED) {
+        if (size == 0) {
+            errno = EINVAL;
+        }
+
+        return false;
+    }
+
+    const auto *header = static_cast<const SharedSnapshotHeader *>(data);
+
+    if (!compatible(header, size)) {
+        ::munmap(data, size);
+        errno = EINVAL;
+        return false;
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    header_ = header;
+    size_ = size;
+
+    return true;
+}
+
+void SharedSnapshotReader::close() {
+    if (header_) {
+        ::munmap(const_cast<SharedSnapshotHeader *>(header_), size_);
+    }
+
+    header_ = nullptr;
+    size_ = 0;
+}
+
+bool SharedSnapshotReader::read(SharedSnapshot &snapshot) const {
+    if (!header_) {
+        return false;
+    }
+
+    // An update takes a fraction of a millisecond, a publisher which died in the middle of one leaves it odd
+    static constexpr int kMaxAttempts = 10000;
+
+    for (int attempt = 0; attempt < kMaxAttempts; attempt++) {
+        if (attempt >= 16) {
+            std::this_thread::yield();
+        }
+
+        const uint32_t before = header_->sequence.load(std::memory_order_acquire);
+
+        if (before & 1) {
+            continue;
+        }
+
+        // The payload may change under the copy, it is only used if the sequence did not
+        const uint32_t count = std::min(header_->processes, header_->capacity);
+
+        snapshot.time = header_->time;
+        snapshot.total = header_->total;
+        std::memcpy(&snapshot.system, &header_->system, sizeof(snapshot.system));
+        snapshot.processes.resize(count);
+
+        // The data of an empty vector may be null
+        if (count > 0) {
+            std::memcpy(snapshot.processes.data(), processesOf(header_), count * sizeof(SharedProcess));
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (header_->sequence.load(std::memory_order_relaxed) == before) {
+            return snapshot.time != 0;
+        }
+    }
+
+    return false;
+}
+
+}  // namespace simple_process_monitor
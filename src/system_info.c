@@ -74,7 +74,9 @@ static bool _init_fixed_system_info(struct FixedSystemInfo *pInfo) {
 }
 
 static void __attribute__((constructor)) _constructor(void) {
-    assert(_init_fixed_system_info(&g_fixed_system_info));
+    // Keep the call out of assert(), it must also run when NDEBUG is defined
+    __attribute__((unused)) bool rv = _init_fixed_system_info(&g_fixed_system_info);
+    assert(rv);
 }
 
 /**
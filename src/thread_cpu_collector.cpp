@@ -0,0 +1,167 @@
+#include <simple_process_monitor/thread_cpu_collector.h>
+
+#include "util/PidIndex.h"
+#include "util/ProcCache.h"
+#include "util/ProcDir.h"
+#include "util/ProcStat.h"
+
+#include <simple_process_monitor/ProcessTree.h>
+#include <simple_process_monitor/system_info.h>
+#include <simple_process_monitor/top_k.h>
+
+namespace simple_process_monitor {
+
+struct ThreadCpuCollector::Context {
+    explicit Context(int maxOpenFiles)
+        : files(ProcCache_new(maxOpenFiles))
+        , directory(ProcDir_new())
+        , index(PidIndex_new(0))
+        , spare(PidIndex_new(0)) {}
+
+    ~Context() {
+        ProcCache_free(&files);
+        ProcDir_free(&directory);
+        PidIndex_free(&index);
+        PidIndex_free(&spare);
+    }
+
+    Context(const Context &) = delete;
+    Context &operator=(const Context &) = delete;
+
+    ProcCache_T files;      // Open stat files of the threads
+    ProcDir_T directory;    // Enumerates the processes, then the threads of every process
+    PidIndex_T index;       // tid -> entry of threads_
+    PidIndex_T spare;       // Swapped with index on every update, keeps previous_ searchable
+    std::vector<int> pids;  // Processes of the current update
+};
+
+namespace {
+
+struct ThreadCpuUsage {
+    float operator()(const ThreadCpuCollector::Thread &thread) const {
+        return thread.usage;
+    }
+};
+
+}  // namespace
+
+// Reads the stat file of a thread through the cache of open descriptors
+static bool readThreadStat(ProcCache_T files, pid_t pid, pid_t tid, ProcStat_T *stat) {
+    char buf[8192];
+
+    ProcCache_Entry_T *file = ProcCache_get(files, pid, tid);
+
+    if (!ProcCache_read(files, file, ProcFile_Stat, buf, sizeof(buf), nullptr) || !ProcStat_parse(buf, stat)) {
+        return false;
+    }
+
+    ProcCache_validate(files, file, stat->starttime);
+
+    return true;
+}
+
+ThreadCpuCollector::ThreadCpuCollector(int maxOpenFiles)
+    : context_(std::make_unique<Context>(maxOpenFiles)) {
+    update();
+}
+
+ThreadCpuCollector::~ThreadCpuCollector() = default;
+
+void ThreadCpuCollector::update() {
+    Context &context = *context_;
+
+    context.pids.clear();
+
+    if (ProcDir_open(context.directory, ALL_PROCESSES)) {
+        for (int pid; (pid = ProcDir_next(context.directory)) >= 0;) {
+            context.pids.push_back(pid);
+        }
+
+        ProcDir_close(context.directory);
+    }
+
+    const unsigned long long now = getNowSingleCoreCpuTime();
+    // The usages are unknown (-1) if the CPU time could not be read, now or at the previous update
+    const double timeDelta = time_ > 0 && now > time_ ? static_cast<double>(now - time_) : 0;
+
+    time_ = now;
+
+    // The entries of the previous update stay searchable through the old index while the new one is built
+    threads_.swap(previous_);
+    threads_.clear();
+    threads_.reserve(previous_.size());
+
+    PidIndex_T oldIndex = context.index;
+    PidIndex_T index = context.spare;
+
+    PidIndex_clear(index, static_cast<int>(previous_.size()));
+    context.index = index;
+    context.spare = oldIndex;
+
+    ProcCache_begin(context.files);
+
+    for (int pid : context.pids) {
+        // The process exited since /proc was read
+        if (!ProcDir_open(context.directory, pid)) {
+            continue;
+        }
+
+        for (int tid; (tid = ProcDir_next(context.directory)) >= 0;) {
+            ProcStat_T stat;
+
+            if (!readThreadStat(context.files, pid, tid, &stat)) {
+                continue;
+            }
+
+            Thread thread{tid,
+                          pid,
+                          stat.starttime,
+                          static_cast<double>(stat.utime + stat.stime) / g_fixed_system_info.hz * 100.,
+                          -1.f};
+
+            const int old = PidIndex_get(oldIndex, tid);
+
+            if (old != -1 && previous_[static_cast<size_t>(old)].starttime == thread.starttime && timeDelta > 0 &&
+                thread.time >= previous_[static_cast<size_t>(old)].time) {
+                const double usage = 100. * (thread.time - previous_[static_cast<size_t>(old)].time) / timeDelta;
+
+                // A thread runs on one CPU at a time
+                thread.usage = static_cast<float>(usage < 100. ? usage : 100.);
+            }
+
+            PidIndex_put(index, tid, static_cast<int>(threads_.size()));
+            threads_.push_back(thread);
+        }
+    }
+
+    ProcDir_close(context.directory);
+    ProcCache_end(context.files);
+}
+
+TopThreadInfos ThreadCpuCollector::getTopThreadInfos(int count) {
+    if (count <= 0) {
+        return {};
+    }
+
+    const auto isMeasured = [](const Thread &thread) {
+        return thread.usage >= 0;
+    };
+
+    TopThreadInfos ret;
+
+    for (const Thread *pThread :
+         topK<ThreadCpuUsage>(threads_.begin(), threads_.end(), static_cast<size_t>(count), isMeasured)) {
+        // Only the threads of the top list need a name. Read stat again, a thread which exited or whose tid was reused
+        // since the update has none.
+        ProcStat_T stat;
+
+        const bool named = readThreadStat(context_->files, pThread->pid, pThread->tid, &stat) &&
+                           stat.starttime == pThread->starttime;
+
+        ret.emplace_back(pThread->tid, pThread->pid, pThread->usage, named ? stat.comm : "(null)");
+    }
+
+    return ret;
+}
+
+}  // namespace simple_process_monitor
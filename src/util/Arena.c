@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "Arena.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "Mem.h"
+
+/**
+ * Implementation of the Arena interface
+ *
+ * @file
+ */
+
+/* ------------------------------------------------------------ Definitions */
+
+#define T Arena_T
+
+#define DEFAULT_CHUNK_SIZE 65536L
+#define ALIGNMENT ((long)_Alignof(max_align_t))
+
+typedef struct Chunk_T {
+    struct Chunk_T *next;  // Previous chunk, chunks are linked from the current one
+    long size;             // Usable bytes
+    long used;
+    max_align_t data[];
+} *Chunk_T;
+
+struct Arena {
+    pthread_mutex_t mutex;
+    Chunk_T chunk;   // Chunk allocations are taken from
+    char *last;      // Last allocation, may grow in place
+    long allocated;  // Bytes allocated in the chunks before the current one
+};
+
+/* ---------------------------------------------------------------- Private */
+
+static inline long _align(long size) {
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+static Chunk_T _newChunk(long size, Chunk_T next) {
+    Chunk_T chunk = ALLOC((long)sizeof(struct Chunk_T) + size);
+    chunk->next = next;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+// Take size bytes from the current chunk, or a new one twice as big if they do not fit
+static void *_alloc(T A, long size) {
+    size = _align(size);
+    if (A->chunk->used + size > A->chunk->size) {
+        long chunkSize = A->chunk->size * 2;
+        while (chunkSize < size)
+            chunkSize *= 2;
+        A->allocated += A->chunk->used;
+        A->chunk = _newChunk(chunkSize, A->chunk);
+    }
+    A->last = (char *)A->chunk->data + A->chunk->used;
+    A->chunk->used += size;
+    return A->last;
+}
+
+/* ----------------------------------------------------------------- Public */
+
+T Arena_new(long hint) {
+    assert(hint >= 0);
+    T A;
+    NEW(A);
+    pthread_mutex_init(&A->mutex, NULL);
+    A->chunk = _newChunk(hint > DEFAULT_CHUNK_SIZE ? _align(hint) : DEFAULT_CHUNK_SIZE, NULL);
+    return A;
+}
+
+void Arena_free(T *A) {
+    assert(A && *A);
+    for (Chunk_T chunk = (*A)->chunk, next; chunk; chunk = next) {
+        next = chunk->next;
+        FREE(chunk);
+    }
+    pthread_mutex_destroy(&(*A)->mutex);
+    FREE(*A);
+}
+
+void Arena_clear(T A) {
+    assert(A);
+    if (A->chunk->next) {
+        // Merge the chunks into one big enough for everything allocated since the last clear
+        long size = A->chunk->size;
+        for (Chunk_T chunk = A->chunk->next, next; chunk; chunk = next) {
+            next = chunk->next;
+            size += chunk->size;
+            FREE(chunk);
+        }
+        FREE(A->chunk);
+        A->chunk = _newChunk(size, NULL);
+    }
+    A->chunk->used = 0;
+    A->allocated = 0;
+    A->last = NULL;
+}
+
+void *Arena_alloc(T A, long size) {
+    assert(A);
+    assert(size > 0);
+    pthread_mutex_lock(&A->mutex);
+    void *p = _alloc(A, size);
+    pthread_mutex_unlock(&A->mutex);
+    return p;
+}
+
+void *Arena_calloc(T A, long count, long size) {
+    assert(count > 0);
+    assert(size > 0);
+    void *p = Arena_alloc(A, count * size);
+    memset(p, 0, count * size);
+    return p;
+}
+
+void *Arena_resize(T A, void *p, long oldSize, long size) {
+    assert(A);
+    assert(size > 0);
+    pthread_mutex_lock(&A->mutex);
+    void *q;
+    if (p && p == A->last && (char *)p + _align(size) <= (char *)A->chunk->data + A->chunk->size) {
+        A->chunk->used = (long)((char *)p - (char *)A->chunk->data) + _align(size);
+        q = p;
+    } else {
+        q = _alloc(A, size);
+        if (p)
+            memcpy(q, p, oldSize < size ? oldSize : size);
+    }
+    pthread_mutex_unlock(&A->mutex);
+    return q;
+}
+
+char *Arena_dup(T A, const char *s) {
+    if (!s)
+        return NULL;
+    long size = (long)strlen(s) + 1;
+    char *t = Arena_alloc(A, size);
+    memcpy(t, s, size);
+    return t;
+}
+
+long Arena_used(T A) {
+    assert(A);
+    pthread_mutex_lock(&A->mutex);
+    long used = A->allocated + A->chunk->used;
+    pthread_mutex_unlock(&A->mutex);
+    return used;
+}
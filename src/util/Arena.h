@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef UTIL_ARENA_H
+#define UTIL_ARENA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * An <b>Arena</b> is a bump allocator for objects which are freed all at
+ * once, such as the entries and strings of a process tree snapshot.
+ * Memory is taken from large chunks and never freed individually, it is
+ * reclaimed by Arena_clear() and reused by the next allocations. After
+ * a clear the chunks are merged into one, so an arena which is filled
+ * with the same amount of data over and over again allocates nothing
+ * once it has grown.
+ *
+ * Allocations are thread-safe. Arena_clear() and Arena_free() must not
+ * run concurrently with other methods.
+ *
+ * @file
+ */
+
+#define T Arena_T
+typedef struct Arena *T;
+
+/**
+ * Factory method, create an empty arena
+ * @param hint The expected number of bytes allocated before each clear
+ * (hint >= 0), 0 for a default size
+ * @return A new Arena object
+ * @exception MemoryException if allocation failed
+ */
+T Arena_new(long hint);
+
+/**
+ * Destroy an Arena object and free all memory allocated from it
+ * @param A an Arena object reference
+ */
+void Arena_free(T *A);
+
+/**
+ * Invalidate all memory allocated from the arena and make it available
+ * for new allocations
+ * @param A Arena object
+ */
+void Arena_clear(T A);
+
+/**
+ * Allocate <code>size</code> bytes aligned for any object
+ * @param A Arena object
+ * @param size number of bytes to allocate (size > 0)
+ * @return A pointer to the allocated memory
+ * @exception MemoryException if allocation failed
+ */
+void *Arena_alloc(T A, long size);
+
+/**
+ * Allocate <code>count</code> objects of <code>size</code> bytes each
+ * and clear the memory
+ * @param A Arena object
+ * @param count number of objects to allocate (count > 0)
+ * @param size object size in bytes (size > 0)
+ * @return A pointer to the allocated memory
+ * @exception MemoryException if allocation failed
+ */
+void *Arena_calloc(T A, long count, long size);
+
+/**
+ * Resize an allocation. If <code>p</code> is the last allocation of the
+ * arena and there is room for <code>size</code> bytes it grows in place,
+ * otherwise the content is copied to a new allocation.
+ * @param A Arena object
+ * @param p The allocation to resize or NULL
+ * @param oldSize The size <code>p</code> was allocated with
+ * @param size The new size in bytes (size > 0)
+ * @return A pointer to the resized allocation
+ * @exception MemoryException if allocation failed
+ */
+void *Arena_resize(T A, void *p, long oldSize, long size);
+
+/**
+ * Copy a string into the arena
+ * @param A Arena object
+ * @param s The string to copy
+ * @return A copy of s or NULL if s is NULL
+ * @exception MemoryException if allocation failed
+ */
+char *Arena_dup(T A, const char *s);
+
+/**
+ * Returns the number of bytes allocated since the last clear
+ * @param A Arena object
+ * @return The number of bytes allocated including alignment padding
+ */
+long Arena_used(T A);
+
+#undef T
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "PidIndex.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "Mem.h"
+
+/**
+ * Implementation of the PidIndex interface
+ *
+ * @file
+ */
+
+/* ------------------------------------------------------------ Definitions */
+
+#define T PidIndex_T
+
+#define MIN_CAPACITY 64
+
+typedef struct Slot_T {
+    int pid;
+    int index;  // -1 if the slot is empty
+} Slot_T;
+
+struct PidIndex {
+    int size;
+    int capacity;  // Always a power of two
+    int shift;
+    Slot_T *slots;
+};
+
+/* ---------------------------------------------------------------- Private */
+
+// Fibonacci hashing, pids are mostly sequential so spread them over the table
+static inline int _hash(T I, int pid) {
+    return (int)(((uint32_t)pid * 2654435769U) >> I->shift);
+}
+
+static void _alloc(T I, int capacity) {
+    I->capacity = MIN_CAPACITY;
+    I->shift = 32 - 6;
+    while (I->capacity < capacity) {
+        I->capacity <<= 1;
+        I->shift--;
+    }
+    I->size = 0;
+    I->slots = ALLOC((long)sizeof(Slot_T) * I->capacity);
+    for (int i = 0; i < I->capacity; i++)
+        I->slots[i].index = -1;
+}
+
+// Keep the load factor at or below 1/2
+static inline int _capacityFor(int hint) {
+    return hint > 0 ? hint * 2 : 0;
+}
+
+static void _grow(T I) {
+    Slot_T *old = I->slots;
+    int oldCapacity = I->capacity;
+    _alloc(I, oldCapacity * 2);
+    for (int i = 0; i < oldCapacity; i++)
+        if (old[i].index != -1)
+            PidIndex_put(I, old[i].pid, old[i].index);
+    FREE(old);
+}
+
+/* ----------------------------------------------------------------- Public */
+
+T PidIndex_new(int hint) {
+    assert(hint >= 0);
+    T I;
+    NEW(I);
+    _alloc(I, _capacityFor(hint));
+    return I;
+}
+
+void PidIndex_free(T *I) {
+    assert(I && *I);
+    FREE((*I)->slots);
+    FREE(*I);
+}
+
+void PidIndex_clear(T I, int hint) {
+    assert(I);
+    assert(hint >= 0);
+    if (I->capacity < _capacityFor(hint)) {
+        FREE(I->slots);
+        _alloc(I, _capacityFor(hint));
+    } else {
+        for (int i = 0; i < I->capacity; i++)
+            I->slots[i].index = -1;
+        I->size = 0;
+    }
+}
+
+void PidIndex_put(T I, int pid, int index) {
+    assert(I);
+    assert(index >= 0);
+    if ((I->size + 1) * 2 > I->capacity)
+        _grow(I);
+    int mask = I->capacity - 1;
+    for (int i = _hash(I, pid);; i = (i + 1) & mask) {
+        if (I->slots[i].index == -1) {
+            I->slots[i].pid = pid;
+            I->slots[i].index = index;
+            I->size++;
+            return;
+        }
+        if (I->slots[i].pid == pid) {
+            I->slots[i].index = index;
+            return;
+        }
+    }
+}
+
+int PidIndex_get(T I, int pid) {
+    assert(I);
+    int mask = I->capacity - 1;
+    for (int i = _hash(I, pid);; i = (i + 1) & mask) {
+        if (I->slots[i].index == -1)
+            return -1;
+        if (I->slots[i].pid == pid)
+            return I->slots[i].index;
+    }
+}
+
+int PidIndex_size(T I) {
+    assert(I);
+    return I->size;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#ifndef UTIL_PID_INDEX_H
+#define UTIL_PID_INDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A <b>PidIndex</b> maps a pid (or tid) to the index of its entry in a
+ * process tree array. It is an open-addressing hash table with linear
+ * probing which is cleared and refilled for every process tree snapshot,
+ * so the slot array is allocated once and reused between refreshes.
+ *
+ * This class is reentrant but not thread-safe
+ *
+ * @file
+ */
+
+#define T PidIndex_T
+typedef struct PidIndex *T;
+
+/**
+ * Factory method, create an empty index
+ * @param hint The expected number of entries (hint >= 0)
+ * @return A new PidIndex object
+ * @exception MemoryException if allocation failed
+ */
+T PidIndex_new(int hint);
+
+/**
+ * Destroy a PidIndex object and free allocated resources
+ * @param I a PidIndex object reference
+ */
+void PidIndex_free(T *I);
+
+/**
+ * Remove all entries and make room for at least <code>hint</code>
+ * entries without rehashing
+ * @param I PidIndex object
+ * @param hint The expected number of entries (hint >= 0)
+ * @exception MemoryException if allocation failed
+ */
+void PidIndex_clear(T I, int hint);
+
+/**
+ * Map <code>pid</code> to <code>index</code>. If the pid is already
+ * present, its index is replaced.
+ * @param I PidIndex object
+ * @param pid The key
+ * @param index The value (index >= 0)
+ * @exception MemoryException if allocation failed
+ */
+void PidIndex_put(T I, int pid, int index);
+
+/**
+ * Look up the index of <code>pid</code>
+ * @param I PidIndex object
+ * @param pid The key
+ * @return The index mapped to pid or -1 if not found
+ */
+int PidIndex_get(T I, int pid);
+
+/**
+ * Returns the number of entries in the index
+ * @param I PidIndex object
+ * @return The number of entries
+ */
+int PidIndex_size(T I);
+
+#undef T
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "ProcCache.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "Mem.h"
+#include "ProcDir.h"
+#include "Str.h"
+#include "debug.h"
+
+/**
+ * Implementation of the ProcCache interface
+ *
+ * @file
+ */
+
+/* ------------------------------------------------------------ Definitions */
+
+#define T ProcCache_T
+
+struct ProcCache {
+    int limit;        // Descriptors this cache may keep open, -1 if unlimited
+    atomic_int open;  // Descriptors this cache keeps open, only counted if limited
+    int budget;       // Descriptors all caches may keep open, updated on every refresh
+    unsigned generation;
+    int count;
+    int capacity;
+    ProcCache_Entry_T *entries;
+    PidIndex_T index;  // pid (or tid) -> entries
+};
+
+static const struct {
+    const char *name;
+    bool perThread;  // Read from /proc/<pid>/task/<tid> for threads, otherwise always from /proc/<pid>
+    int flags;
+} _files[ProcFile_Count] = {
+    [ProcFile_Stat] = {"stat", true, O_RDONLY},
+    [ProcFile_Status] = {"status", true, O_RDONLY},
+    [ProcFile_Io] = {"io", true, O_RDONLY},
+    [ProcFile_Cmdline] = {"cmdline", false, O_RDONLY},
+    [ProcFile_Limits] = {"limits", false, O_RDONLY},
+    [ProcFile_AttrCurrent] = {"attr/current", true, O_RDONLY},
+    [ProcFile_Fd] = {"fd", false, O_RDONLY | O_DIRECTORY},
+};
+
+// Descriptors kept open by all caches of this process
+static atomic_int _descriptors;
+
+/* ---------------------------------------------------------------- Private */
+
+static int _budget(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur / 2 > INT_MAX)
+        return INT_MAX;
+    // Leave half of the descriptors to the application
+    return (int)(rl.rlim_cur / 2);
+}
+
+static int _open(ProcCache_Entry_T *E, ProcFile_T file) {
+    char path[STRLEN];
+    if (E->tid < 0 || !_files[file].perThread)
+        snprintf(path, sizeof(path), "/proc/%d/%s", E->pid, _files[file].name);
+    else
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/%s", E->pid, E->tid, _files[file].name);
+    int fd = open(path, _files[file].flags | O_CLOEXEC);
+    if (fd < 0)
+        DEBUG("Cannot open proc file '%s' -- %s\n", path, STRERROR);
+    return fd;
+}
+
+static bool _claim(T C) {
+    if (C->limit >= 0 && atomic_fetch_add(&C->open, 1) >= C->limit) {
+        atomic_fetch_sub(&C->open, 1);
+        return false;
+    }
+    if (atomic_fetch_add(&_descriptors, 1) >= C->budget) {
+        atomic_fetch_sub(&_descriptors, 1);
+        if (C->limit >= 0)
+            atomic_fetch_sub(&C->open, 1);
+        return false;
+    }
+    return true;
+}
+
+static void _closeAll(T C, ProcCache_Entry_T *E) {
+    for (int i = 0; i < ProcFile_Count; i++) {
+        if (E->fd[i] >= 0) {
+            close(E->fd[i]);
+            E->fd[i] = -1;
+            atomic_fetch_sub(&_descriptors, 1);
+            if (C->limit >= 0)
+                atomic_fetch_sub(&C->open, 1);
+        }
+    }
+}
+
+// Close the descriptors and drop the cached data of a process which exited
+static void _release(T C, ProcCache_Entry_T *E) {
+    _closeAll(C, E);
+    FREE(E->cmdline);
+}
+
+/**
+ * Returns the descriptor of the file, opening it if needed
+ * @param transient set to true if the descriptor could not be cached and must be closed by the caller
+ * @return The descriptor or -1 if failed
+ */
+static int _acquire(T C, ProcCache_Entry_T *E, ProcFile_T file, bool *transient) {
+    *transient = false;
+    if (E->fd[file] >= 0)
+        return E->fd[file];
+    int fd = _open(E, file);
+    if (fd >= 0) {
+        if (_claim(C))
+            E->fd[file] = fd;
+        else
+            *transient = true;
+    }
+    return fd;
+}
+
+// A cached descriptor of an exited process fails with ESRCH (or ENOENT for directories), the pid may be reused
+static inline bool _isGone(int error) {
+    return error == ESRCH || error == ENOENT;
+}
+
+/* ----------------------------------------------------------------- Public */
+
+T ProcCache_new(int limit) {
+    T C;
+    NEW(C);
+    C->limit = limit;
+    C->budget = _budget();
+    C->index = PidIndex_new(0);
+    return C;
+}
+
+void ProcCache_free(T *C) {
+    assert(C && *C);
+    for (int i = 0; i < (*C)->count; i++)
+        _release(*C, &(*C)->entries[i]);
+    PidIndex_free(&(*C)->index);
+    FREE((*C)->entries);
+    FREE(*C);
+}
+
+void ProcCache_begin(T C) {
+    assert(C);
+    C->generation++;
+    C->budget = _budget();
+}
+
+void ProcCache_reserve(T C, int n) {
+    assert(C);
+    assert(n >= 0);
+    if (C->count + n > C->capacity) {
+        C->capacity = C->count + n;
+        RESIZE(C->entries, (long)sizeof(ProcCache_Entry_T) * C->capacity);
+    }
+}
+
+ProcCache_Entry_T *ProcCache_get(T C, int pid, int tid) {
+    assert(C);
+    int i = PidIndex_get(C->index, tid >= 0 ? tid : pid);
+    if (i == -1) {
+        if (C->count == C->capacity)
+            ProcCache_reserve(C, C->count ? C->count : 64);
+        i = C->count++;
+        ProcCache_Entry_T *E = &C->entries[i];
+        E->pid = pid;
+        E->tid = tid;
+        E->starttime = 0;
+        for (int j = 0; j < ProcFile_Count; j++)
+            E->fd[j] = -1;
+        E->cmdline = NULL;
+        PidIndex_put(C->index, tid >= 0 ? tid : pid, i);
+    }
+    C->entries[i].generation = C->generation;
+    return &C->entries[i];
+}
+
+void ProcCache_end(T C) {
+    assert(C);
+    int count = 0;
+    for (int i = 0; i < C->count; i++) {
+        if (C->entries[i].generation != C->generation) {
+            _release(C, &C->entries[i]);
+            continue;
+        }
+        if (count != i)
+            C->entries[count] = C->entries[i];
+        count++;
+    }
+    if (count != C->count) {
+        C->count = count;
+        PidIndex_clear(C->index, count);
+        for (int i = 0; i < count; i++)
+            PidIndex_put(C->index, C->entries[i].tid >= 0 ? C->entries[i].tid : C->entries[i].pid, i);
+    }
+}
+
+void ProcCache_validate(T C, ProcCache_Entry_T *E, unsigned long long starttime) {
+    assert(C);
+    assert(E);
+    if (E->starttime != starttime) {
+        if (E->starttime)
+            _release(C, E);
+        E->starttime = starttime;
+    }
+}
+
+const char *ProcCache_cmdline(__attribute__((unused)) T C, ProcCache_Entry_T *E, int key) {
+    assert(C);
+    assert(E);
+    if (E->cmdline && E->cmdlineKey != key)
+        FREE(E->cmdline);
+    return E->cmdline;
+}
+
+void ProcCache_setCmdline(__attribute__((unused)) T C, ProcCache_Entry_T *E, int key, const char *cmdline) {
+    assert(C);
+    assert(E);
+    assert(cmdline);
+    FREE(E->cmdline);
+    E->cmdline = Str_dup(cmdline);
+    E->cmdlineKey = key;
+}
+
+int ProcCache_pread(T C, ProcCache_Entry_T *E, ProcFile_T file, char *buf, int size, long offset) {
+    assert(C);
+    assert(E);
+    assert(buf);
+    bool cached = E->fd[file] >= 0;
+    bool transient;
+    int fd = _acquire(C, E, file, &transient);
+    if (fd < 0)
+        return -1;
+    ssize_t n = pread(fd, buf, size, offset);
+    if (n < 0 && cached && _isGone(errno)) {
+        _closeAll(C, E);
+        if ((fd = _acquire(C, E, file, &transient)) < 0)
+            return -1;
+        n = pread(fd, buf, size, offset);
+    }
+    if (n < 0)
+        DEBUG("Cannot read proc file '%s' of %d -- %s\n", _files[file].name, E->tid >= 0 ? E->tid : E->pid, STRERROR);
+    if (transient)
+        close(fd);
+    return (int)n;
+}
+
+bool ProcCache_read(T C, ProcCache_Entry_T *E, ProcFile_T file, char *buf, int buf_size, int *bytes_read) {
+    assert(buf_size > 0);
+    int bytes = ProcCache_pread(C, E, file, buf, buf_size - 1, 0);
+    if (bytes < 0) {
+        *buf = 0;
+        return false;
+    }
+    buf[bytes] = 0;
+    if (bytes_read)
+        *bytes_read = bytes;
+    return true;
+}
+
+long long ProcCache_countEntries(T C, ProcCache_Entry_T *E, ProcFile_T file) {
+    assert(C);
+    assert(E);
+    bool cached = E->fd[file] >= 0;
+    bool transient;
+    int fd = _acquire(C, E, file, &transient);
+    if (fd < 0)
+        return -1;
+    long long count = ProcDir_countEntries(fd);
+    if (count < 0 && cached && _isGone(errno)) {
+        _closeAll(C, E);
+        if ((fd = _acquire(C, E, file, &transient)) < 0)
+            return -1;
+        count = ProcDir_countEntries(fd);
+    }
+    if (transient)
+        close(fd);
+    return count;
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#ifndef UTIL_PROC_CACHE_H
+#define UTIL_PROC_CACHE_H
+
+#include <stdbool.h>
+
+#include "PidIndex.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A <b>ProcCache</b> keeps the /proc/<pid> (or /proc/<pid>/task/<tid>)
+ * files of every process open between refreshes, so a refresh costs one
+ * pread(2) per file instead of open/read/close and a path resolution.
+ *
+ * Entries are keyed by pid (or tid) and the process start time, a
+ * reused pid drops the descriptors and the command line of the previous
+ * process. Entries of
+ * processes which were not seen during a refresh are closed when the
+ * refresh ends.
+ *
+ * All caches together keep at most half of RLIMIT_NOFILE descriptors
+ * open. When the budget is exhausted files are read with open/read/close
+ * as usual instead of evicting open ones: a refresh reads every process
+ * in the same order, so evicting would make every read a miss.
+ *
+ * This class is reentrant but not thread-safe, except that different
+ * entries may be read concurrently once they were all obtained with
+ * ProcCache_get() after a ProcCache_reserve() for them.
+ *
+ * @file
+ */
+
+#define T ProcCache_T
+typedef struct ProcCache *T;
+
+/** Files of a process (or thread) read during a refresh */
+typedef enum {
+    ProcFile_Stat = 0,
+    ProcFile_Status,
+    ProcFile_Io,
+    ProcFile_Cmdline,
+    ProcFile_Limits,
+    ProcFile_AttrCurrent,
+    ProcFile_Fd,  // Directory
+    ProcFile_Count
+} ProcFile_T;
+
+typedef struct ProcCache_Entry_T {
+    int pid;
+    int tid;  // -1 if this is a process
+    unsigned long long starttime;
+    unsigned generation;
+    int fd[ProcFile_Count];  // -1 if not open
+    char *cmdline;           // Joined command line, NULL if not cached
+    int cmdlineKey;          // Identifies the program the command line was read from
+} ProcCache_Entry_T;
+
+/**
+ * Factory method, create an empty cache
+ * @param limit The maximum number of descriptors this cache keeps open,
+ * -1 to only apply the process wide budget, 0 to disable caching
+ * @return A new ProcCache object
+ * @exception MemoryException if allocation failed
+ */
+T ProcCache_new(int limit);
+
+/**
+ * Destroy a ProcCache object, closing all cached descriptors
+ * @param C a ProcCache object reference
+ */
+void ProcCache_free(T *C);
+
+/**
+ * Start a refresh
+ * @param C ProcCache object
+ */
+void ProcCache_begin(T C);
+
+/**
+ * Make room for <code>n</code> new entries, so entries returned by the
+ * next <code>n</code> ProcCache_get() calls stay valid until
+ * ProcCache_end()
+ * @param C ProcCache object
+ * @param n The number of new entries
+ * @exception MemoryException if allocation failed
+ */
+void ProcCache_reserve(T C, int n);
+
+/**
+ * Returns the entry of the process (or thread) and marks it as seen in
+ * this refresh. The entry is valid until the next ProcCache_get() or
+ * ProcCache_end() call.
+ * @param C ProcCache object
+ * @param pid The process id
+ * @param tid The thread id or -1 for the process itself
+ * @return The entry, never NULL
+ * @exception MemoryException if allocation failed
+ */
+ProcCache_Entry_T *ProcCache_get(T C, int pid, int tid);
+
+/**
+ * End a refresh, closing entries of processes which were not seen
+ * @param C ProcCache object
+ */
+void ProcCache_end(T C);
+
+/**
+ * Record the start time of the process read from its stat file. If the
+ * entry belonged to another process with the same pid before, all its
+ * other descriptors are closed.
+ * @param C ProcCache object
+ * @param E The entry
+ * @param starttime The start time in jiffies since boot
+ */
+void ProcCache_validate(T C, ProcCache_Entry_T *E, unsigned long long starttime);
+
+/**
+ * Returns the command line cached by ProcCache_setCmdline()
+ * @param C ProcCache object
+ * @param E The entry
+ * @param key Identifies the program, such as a hash of the process name
+ * in the stat file. The cached command line is dropped if the key differs,
+ * so a process which called exec(3) since is read again.
+ * @return The command line or NULL if not cached
+ */
+const char *ProcCache_cmdline(T C, ProcCache_Entry_T *E, int key);
+
+/**
+ * Cache the command line of the process until it exits or its key changes
+ * @param C ProcCache object
+ * @param E The entry
+ * @param key Identifies the program, see ProcCache_cmdline()
+ * @param cmdline The joined command line
+ * @exception MemoryException if allocation failed
+ */
+void ProcCache_setCmdline(T C, ProcCache_Entry_T *E, int key, const char *cmdline);
+
+/**
+ * Read from a file of the process at the given offset
+ * @param C ProcCache object
+ * @param E The entry
+ * @param file The file to read
+ * @param buf buffer to write to
+ * @param size size of buf
+ * @param offset The file offset
+ * @return The number of bytes read or -1 if failed
+ */
+int ProcCache_pread(T C, ProcCache_Entry_T *E, ProcFile_T file, char *buf, int size, long offset);
+
+/**
+ * Reads a file of the process from the beginning, like file_readProc()
+ * @param C ProcCache object
+ * @param E The entry
+ * @param file The file to read
+ * @param buf buffer to write to, always NUL terminated
+ * @param buf_size size of buf
+ * @param bytes_read number of bytes read to buffer
+ * @return true if succeeded otherwise false.
+ */
+bool ProcCache_read(T C, ProcCache_Entry_T *E, ProcFile_T file, char *buf, int buf_size, int *bytes_read);
+
+/**
+ * Count the entries of a directory of the process, including '.' and '..'
+ * @param C ProcCache object
+ * @param E The entry
+ * @param file The directory to read
+ * @return The number of entries or -1 if failed
+ */
+long long ProcCache_countEntries(T C, ProcCache_Entry_T *E, ProcFile_T file);
+
+#undef T
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
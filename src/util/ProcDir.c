@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "ProcDir.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "Mem.h"
+#include "Str.h"
+#include "debug.h"
+
+/**
+ * Implementation of the ProcDir interface
+ *
+ * @file
+ */
+
+/* ------------------------------------------------------------ Definitions */
+
+#define T ProcDir_T
+
+#define BUFFER_SIZE 32768
+
+// Layout of the records returned by getdents64(2)
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct ProcDir {
+    int fd;
+    long length;    // Bytes in buffer
+    long position;  // Offset of the next record in buffer
+    char *buffer;
+};
+
+/* ---------------------------------------------------------------- Private */
+
+static inline long _getdents(int fd, char *buffer, long size) {
+    return syscall(SYS_getdents64, fd, buffer, size);
+}
+
+// Parse a pid, returns -1 if the name is not a number
+static inline int _parsePid(const char *name) {
+    int pid = 0;
+    if (!*name)
+        return -1;
+    for (; *name; name++) {
+        if (*name < '0' || *name > '9' || pid > (INT32_MAX - 9) / 10)
+            return -1;
+        pid = pid * 10 + (*name - '0');
+    }
+    return pid;
+}
+
+/* ----------------------------------------------------------------- Public */
+
+T ProcDir_new(void) {
+    T D;
+    NEW(D);
+    D->fd = -1;
+    D->buffer = ALLOC(BUFFER_SIZE);
+    return D;
+}
+
+void ProcDir_free(T *D) {
+    assert(D && *D);
+    ProcDir_close(*D);
+    FREE((*D)->buffer);
+    FREE(*D);
+}
+
+bool ProcDir_open(T D, int pid) {
+    assert(D);
+    ProcDir_close(D);
+    char path[STRLEN];
+    if (pid < 0)
+        snprintf(path, sizeof(path), "/proc");
+    else
+        snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    if ((D->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        DEBUG("system statistic error -- cannot open %s: %s\n", path, STRERROR);
+        return false;
+    }
+    D->length = D->position = 0;
+    return true;
+}
+
+int ProcDir_next(T D) {
+    assert(D);
+    if (D->fd < 0)
+        return -1;
+    while (true) {
+        while (D->position < D->length) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(D->buffer + D->position);
+            D->position += entry->d_reclen;
+            int pid = _parsePid(entry->d_name);
+            if (pid >= 0)
+                return pid;
+        }
+        if ((D->length = _getdents(D->fd, D->buffer, BUFFER_SIZE)) <= 0) {
+            if (D->length < 0)
+                DEBUG("system statistic error -- getdents64 failed: %s\n", STRERROR);
+            D->length = 0;
+            return -1;
+        }
+        D->position = 0;
+    }
+}
+
+void ProcDir_close(T D) {
+    assert(D);
+    if (D->fd >= 0) {
+        close(D->fd);
+        D->fd = -1;
+    }
+}
+
+long long ProcDir_countEntries(int fd) {
+    char buffer[16384] __attribute__((aligned(8)));
+    long long count = 0;
+    if (lseek(fd, 0, SEEK_SET) < 0)
+        return -1;
+    while (true) {
+        long n = _getdents(fd, buffer, sizeof(buffer));
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            return count;
+        for (long position = 0; position < n; position += ((struct linux_dirent64 *)(buffer + position))->d_reclen)
+            count++;
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#ifndef UTIL_PROC_DIR_H
+#define UTIL_PROC_DIR_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A <b>ProcDir</b> enumerates the processes in /proc or the threads in
+ * /proc/<pid>/task. Directory entries are read with getdents64(2) into
+ * a buffer which is reused for every directory, and numeric names are
+ * parsed in place, so enumerating allocates nothing. Entries are
+ * returned in the order of the kernel, which is ascending for procfs.
+ *
+ * This class is reentrant but not thread-safe
+ *
+ * @file
+ */
+
+#define T ProcDir_T
+typedef struct ProcDir *T;
+
+/**
+ * Factory method, create an enumerator
+ * @return A new ProcDir object
+ * @exception MemoryException if allocation failed
+ */
+T ProcDir_new(void);
+
+/**
+ * Destroy a ProcDir object, closing the directory if open
+ * @param D a ProcDir object reference
+ */
+void ProcDir_free(T *D);
+
+/**
+ * Open /proc, or /proc/<pid>/task to enumerate the threads of a process
+ * @param D ProcDir object
+ * @param pid The process or < 0 to enumerate all processes
+ * @return true if succeeded otherwise false.
+ */
+bool ProcDir_open(T D, int pid);
+
+/**
+ * Returns the next pid (or tid) of the open directory
+ * @param D ProcDir object
+ * @return The next pid or -1 at the end of the directory or if failed
+ */
+int ProcDir_next(T D);
+
+/**
+ * Close the open directory
+ * @param D ProcDir object
+ */
+void ProcDir_close(T D);
+
+/**
+ * Count the entries of a directory including '.' and '..', from its
+ * beginning and independent of its current offset
+ * @param fd Descriptor of the directory
+ * @return The number of entries or -1 if failed
+ */
+long long ProcDir_countEntries(int fd);
+
+#undef T
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "ProcStat.h"
+
+#include <assert.h>
+#include <string.h>
+
+/**
+ * Implementation of the ProcStat interface
+ *
+ * @file
+ */
+
+/* ---------------------------------------------------------------- Private */
+
+// Decode a decimal number and the separator following it
+static inline bool _number(const char **s, unsigned long long *value, bool *negative) {
+    const char *p = *s;
+    *negative = *p == '-';
+    if (*negative)
+        p++;
+    unsigned digit = (unsigned)(*p - '0');
+    if (digit > 9)
+        return false;
+    unsigned long long v = 0;
+    do {
+        v = v * 10 + digit;
+        digit = (unsigned)(*++p - '0');
+    } while (digit <= 9);
+    if (*p == ' ' || *p == '\n')
+        p++;
+    else if (*p)
+        return false;
+    *value = v;
+    *s = p;
+    return true;
+}
+
+static inline bool _unsigned(const char **s, unsigned long long *value) {
+    bool negative;
+    return _number(s, value, &negative) && !negative;
+}
+
+static inline bool _signed(const char **s, long long *value) {
+    unsigned long long v;
+    bool negative;
+    if (!_number(s, &v, &negative))
+        return false;
+    *value = negative ? -(long long)v : (long long)v;
+    return true;
+}
+
+// Skip n fields
+static inline bool _skip(const char **s, int n) {
+    const char *p = *s;
+    while (n--) {
+        if (!(p = strchr(p, ' ')))
+            return false;
+        p++;
+    }
+    *s = p;
+    return true;
+}
+
+/* ----------------------------------------------------------------- Public */
+
+bool ProcStat_parse(const char *s, ProcStat_T *stat) {
+    assert(s);
+    assert(stat);
+    // The process name is in parentheses and can contain anything, including spaces and ')'
+    const char *name = strchr(s, '(');
+    const char *p = strrchr(s, ')');
+    if (!name || !p || p < name || p[1] != ' ')
+        return false;
+    size_t length = (size_t)(p - name - 1);
+    if (length >= sizeof(stat->comm))
+        length = sizeof(stat->comm) - 1;
+    memcpy(stat->comm, name + 1, length);
+    stat->comm[length] = 0;
+    p += 2;
+    // (3) state
+    if (!*p || p[1] != ' ')
+        return false;
+    stat->state = *p;
+    p += 2;
+    unsigned long long u;
+    long long d;
+    // (4) ppid, skip (5) pgrp to (9) flags
+    if (!_signed(&p, &d) || !_skip(&p, 5))
+        return false;
+    stat->ppid = (int)d;
+    // (10) minflt, skip (11) cminflt
+    if (!_unsigned(&p, &u) || !_skip(&p, 1))
+        return false;
+    stat->minflt = (unsigned long)u;
+    // (12) majflt, skip (13) cmajflt
+    if (!_unsigned(&p, &u) || !_skip(&p, 1))
+        return false;
+    stat->majflt = (unsigned long)u;
+    // (14) utime, (15) stime
+    if (!_unsigned(&p, &u))
+        return false;
+    stat->utime = (unsigned long)u;
+    if (!_unsigned(&p, &u))
+        return false;
+    stat->stime = (unsigned long)u;
+    // (16) cutime, (17) cstime, (18) priority, (19) nice
+    if (!_signed(&p, &d))
+        return false;
+    stat->cutime = (long)d;
+    if (!_signed(&p, &d))
+        return false;
+    stat->cstime = (long)d;
+    if (!_signed(&p, &d))
+        return false;
+    stat->priority = (long)d;
+    if (!_signed(&p, &d))
+        return false;
+    stat->nice = (long)d;
+    // (20) num_threads, skip (21) itrealvalue
+    if (!_signed(&p, &d) || !_skip(&p, 1))
+        return false;
+    stat->threads = (int)d;
+    // (22) starttime, skip (23) vsize
+    if (!_unsigned(&p, &u) || !_skip(&p, 1))
+        return false;
+    stat->starttime = u;
+    // (24) rss
+    if (!_signed(&p, &d))
+        return false;
+    stat->rss = (long)d;
+    // Skip (25) rsslim to (38) exit_signal, (39) processor exists since Linux 2.2.8
+    stat->processor = -1;
+    if (_skip(&p, 14) && _signed(&p, &d))
+        stat->processor = (int)d;
+    return true;
+}
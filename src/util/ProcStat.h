@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#ifndef UTIL_PROC_STAT_H
+#define UTIL_PROC_STAT_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Parser of the /proc/<pid>/stat (or /proc/<pid>/task/<tid>/stat) file.
+ * Fields are decoded in place by a tokenizer which skips past the last
+ * ')' of the process name, so the parser allocates nothing and neither
+ * calls sscanf(3) nor depends on the locale. See proc(5) for the fields.
+ *
+ * @file
+ */
+
+/** Size of the process name buffer, kernel worker names can be longer than TASK_COMM_LEN */
+#define PROC_STAT_COMM_LEN 64
+
+typedef struct ProcStat_T {
+    char comm[PROC_STAT_COMM_LEN];  // Process name without the parentheses, truncated if longer
+    char state;
+    int ppid;
+    unsigned long minflt;  // Minor page faults
+    unsigned long majflt;  // Major page faults
+    unsigned long utime;   // Jiffies
+    unsigned long stime;   // Jiffies
+    long cutime;           // Jiffies
+    long cstime;           // Jiffies
+    long priority;
+    long nice;
+    int threads;
+    unsigned long long starttime;  // Jiffies since boot
+    long rss;                      // Pages
+    int processor;                 // CPU last executed on, -1 if the kernel does not report it
+} ProcStat_T;
+
+/**
+ * Parse the content of a stat file
+ * @param s NUL terminated content of the file
+ * @param stat The fields to fill
+ * @return true if succeeded, false if the content is not a stat file
+ */
+bool ProcStat_parse(const char *s, ProcStat_T *stat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "WorkerPool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "Mem.h"
+#include "debug.h"
+
+/**
+ * Implementation of the WorkerPool interface
+ *
+ * @file
+ */
+
+/* ------------------------------------------------------------ Definitions */
+
+#define T WorkerPool_T
+
+struct WorkerPool {
+    int threads;  // Started threads, the caller of WorkerPool_run() is the last worker
+    pthread_t *thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned generation;  // Incremented for every job
+    bool stop;
+    int running;  // Threads which have not finished the current job
+    void (*job)(void *arg, int shard);
+    void *arg;
+    int shards;
+    atomic_int next;  // Next shard to run
+};
+
+/* ---------------------------------------------------------------- Private */
+
+static void _work(T P) {
+    int shard;
+    while ((shard = atomic_fetch_add(&P->next, 1)) < P->shards)
+        P->job(P->arg, shard);
+}
+
+static void *_thread(void *arg) {
+    T P = arg;
+    unsigned generation = 0;
+    pthread_mutex_lock(&P->mutex);
+    while (true) {
+        while (!P->stop && P->generation == generation)
+            pthread_cond_wait(&P->start, &P->mutex);
+        if (P->stop)
+            break;
+        generation = P->generation;
+        pthread_mutex_unlock(&P->mutex);
+        _work(P);
+        pthread_mutex_lock(&P->mutex);
+        if (--P->running == 0)
+            pthread_cond_signal(&P->done);
+    }
+    pthread_mutex_unlock(&P->mutex);
+    return NULL;
+}
+
+/* ----------------------------------------------------------------- Public */
+
+T WorkerPool_new(int workers) {
+    assert(workers > 0);
+    T P;
+    NEW(P);
+    pthread_mutex_init(&P->mutex, NULL);
+    pthread_cond_init(&P->start, NULL);
+    pthread_cond_init(&P->done, NULL);
+    if (workers > 1) {
+        P->thread = CALLOC(workers - 1, sizeof(pthread_t));
+        for (int i = 0; i < workers - 1; i++) {
+            if (pthread_create(&P->thread[i], NULL, _thread, P) != 0) {
+                Log_error("Failed to start worker thread -- %s\n", STRERROR);
+                break;
+            }
+            P->threads++;
+        }
+    }
+    return P;
+}
+
+void WorkerPool_free(T *P) {
+    assert(P && *P);
+    pthread_mutex_lock(&(*P)->mutex);
+    (*P)->stop = true;
+    pthread_cond_broadcast(&(*P)->start);
+    pthread_mutex_unlock(&(*P)->mutex);
+    for (int i = 0; i < (*P)->threads; i++)
+        pthread_join((*P)->thread[i], NULL);
+    pthread_cond_destroy(&(*P)->done);
+    pthread_cond_destroy(&(*P)->start);
+    pthread_mutex_destroy(&(*P)->mutex);
+    FREE((*P)->thread);
+    FREE(*P);
+}
+
+int WorkerPool_workers(T P) {
+    assert(P);
+    return P->threads + 1;
+}
+
+void WorkerPool_run(T P, void (*job)(void *arg, int shard), void *arg, int shards) {
+    assert(P);
+    assert(job);
+    pthread_mutex_lock(&P->mutex);
+    P->job = job;
+    P->arg = arg;
+    P->shards = shards;
+    atomic_store(&P->next, 0);
+    P->running = P->threads;
+    P->generation++;
+    pthread_cond_broadcast(&P->start);
+    pthread_mutex_unlock(&P->mutex);
+    _work(P);
+    pthread_mutex_lock(&P->mutex);
+    while (P->running > 0)
+        pthread_cond_wait(&P->done, &P->mutex);
+    pthread_mutex_unlock(&P->mutex);
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#ifndef UTIL_WORKER_POOL_H
+#define UTIL_WORKER_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A <b>WorkerPool</b> is a fixed set of threads which run the shards of
+ * one job at a time. The threads are started once and sleep between
+ * jobs, so running a job costs no thread creation.
+ *
+ * This class is not reentrant, one job at a time may be run
+ *
+ * @file
+ */
+
+#define T WorkerPool_T
+typedef struct WorkerPool *T;
+
+/**
+ * Factory method, create a pool and start its threads
+ * @param workers The number of threads running a job including the
+ * caller of WorkerPool_run(), so workers - 1 threads are started
+ * (workers > 0)
+ * @return A new WorkerPool object
+ * @exception MemoryException if allocation failed
+ */
+T WorkerPool_new(int workers);
+
+/**
+ * Stop the threads and free the pool
+ * @param P a WorkerPool object reference
+ */
+void WorkerPool_free(T *P);
+
+/**
+ * Returns the number of threads running a job, including the caller
+ * @param P WorkerPool object
+ * @return The number of workers
+ */
+int WorkerPool_workers(T P);
+
+/**
+ * Call <code>job(arg, shard)</code> for every shard in [0, shards) on
+ * the pool threads and the calling thread, and return when all shards
+ * are done. Shards are handed out in order to whichever thread is idle.
+ * @param P WorkerPool object
+ * @param job The function to run for every shard
+ * @param arg The argument passed to job
+ * @param shards The number of shards
+ */
+void WorkerPool_run(T P, void (*job)(void *arg, int shard), void *arg, int shards);
+
+#undef T
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,685 @@
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/PidIndex.h"
+#include "util/ProcStat.h"
+
+#include <simple_process_monitor/async_logger.h>
+#include <simple_process_monitor/compressed_history.h>
+#include <simple_process_monitor/json_writer.h>
+#include <simple_process_monitor/metrics_exporter.h>
+#include <simple_process_monitor/process_history.h>
+#include <simple_process_monitor/process_tree_wrapper.h>
+#include <simple_process_monitor/rollup_history.h>
+#include <simple_process_monitor/segment_file.h>
+#include <simple_process_monitor/shared_snapshot.h>
+#include <simple_process_monitor/thread_cpu_collector.h>
+#include <simple_process_monitor/top_k.h>
+
+// Keeps the compiler from optimizing the measured work away
+static volatile long g_sink;
+
+template <typename F>
+static double measureMs(int rounds, F &&f) {
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < rounds; i++) {
+        f();
+    }
+
+    const auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count() / rounds;
+}
+
+struct FakeProcess {
+    int pid;
+    int ppid;
+};
+
+// Pids are unique and not contiguous, parents are random earlier processes like after a long uptime
+static std::vector<FakeProcess> makeFakeProcesses(int n, std::mt19937 &rng) {
+    std::vector<FakeProcess> processes(static_cast<size_t>(n));
+    std::vector<int> pids(static_cast<size_t>(n) * 4);
+
+    std::iota(pids.begin(), pids.end(), 2);
+    std::shuffle(pids.begin(), pids.end(), rng);
+    pids.resize(static_cast<size_t>(n));
+    std::sort(pids.begin(), pids.end());
+
+    for (size_t i = 0; i < processes.size(); i++) {
+        processes[i].pid = pids[i];
+        processes[i].ppid = i == 0 ? 0 : pids[std::uniform_int_distribution<size_t>(0, i - 1)(rng)];
+    }
+
+    return processes;
+}
+
+static int linearFind(const std::vector<FakeProcess> &processes, int pid) {
+    for (size_t i = 0; i < processes.size(); i++) {
+        if (processes[i].pid == pid) {
+            return static_cast<int>(i);
+        }
+    }
+
+    return -1;
+}
+
+// What ProcessTree_init does per refresh: match every process with the old snapshot, then find its parent
+static void benchProcessTreeLinking() {
+    std::mt19937 rng{42};
+
+    printf("ProcessTree_init linking (old entry + parent lookup per process), ms per refresh\n");
+    printf("%10s %14s %14s\n", "processes", "linear scan", "pid index");
+
+    for (int n : {1000, 5000, 10000, 20000, 40000}) {
+        const std::vector<FakeProcess> oldProcesses = makeFakeProcesses(n, rng);
+        std::vector<FakeProcess> newProcesses = oldProcesses;
+
+        // About 1% of processes exited and were replaced since the previous refresh
+        for (size_t i = 0; i < newProcesses.size(); i += 100) {
+            newProcesses[i].pid += 1;
+        }
+
+        long sink = 0;
+
+        const double linearMs = measureMs(n <= 10000 ? 3 : 1, [&]() {
+            for (const FakeProcess &p : newProcesses) {
+                sink += linearFind(oldProcesses, p.pid);
+                sink += linearFind(newProcesses, p.ppid);
+            }
+        });
+
+        PidIndex_T oldIndex = PidIndex_new(n);
+        PidIndex_T index = PidIndex_new(n);
+
+        for (size_t i = 0; i < oldProcesses.size(); i++) {
+            PidIndex_put(oldIndex, oldProcesses[i].pid, static_cast<int>(i));
+        }
+
+        const double indexMs = measureMs(20, [&]() {
+            PidIndex_clear(index, n);
+
+            for (size_t i = 0; i < newProcesses.size(); i++) {
+                PidIndex_put(index, newProcesses[i].pid, static_cast<int>(i));
+            }
+
+            for (const FakeProcess &p : newProcesses) {
+                sink += PidIndex_get(oldIndex, p.pid);
+                sink += PidIndex_get(index, p.ppid);
+            }
+        });
+
+        PidIndex_free(&oldIndex);
+        PidIndex_free(&index);
+
+        g_sink = sink;
+
+        printf("%10d %14.3f %14.3f\n", n, linearMs, indexMs);
+    }
+
+    printf("\n");
+}
+
+static void benchProcessTreeRefresh() {
+    using namespace simple_process_monitor;
+
+    for (int workers : {1, 2, 4, 8}) {
+        ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES, ProcessTree_CollectAll, workers};
+
+        const double ms = measureMs(10, [&]() {
+            processTreeWrapper.update();
+        });
+
+        printf("ProcessTree_init full refresh of this host with %d workers: %.3f ms\n", workers, ms);
+    }
+
+    for (TopInfoType type : {TopInfoType::CPU, TopInfoType::RAM}) {
+        const char *name = type == TopInfoType::CPU ? "CPU" : "RAM";
+        ProcessTreeWrapper allWrapper{ALL_PROCESSES, ProcessTree_CollectAll};
+        ProcessTreeWrapper rankWrapper{ALL_PROCESSES, collectFlagsOf(type)};
+        long sink = 0;
+
+        const double allMs = measureMs(10, [&]() {
+            allWrapper.update();
+            sink += static_cast<long>(allWrapper.getTopProcessInfos(type, 5).size());
+        });
+
+        const double rankMs = measureMs(10, [&]() {
+            rankWrapper.update();
+            sink += static_cast<long>(rankWrapper.getTopProcessInfos(type, 5).size());
+        });
+
+        g_sink = sink;
+
+        printf("Top 5 %s of this host: %.3f ms collecting everything, %.3f ms ranking first\n", name, allMs, rankMs);
+    }
+
+    {
+        long sink = 0;
+
+        const double separateMs = measureMs(10, [&]() {
+            for (size_t i = 0; i < kTopInfoTypeCount; i++) {
+                const auto type = static_cast<TopInfoType>(i);
+                ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES, collectFlagsOf(type)};
+                sink += static_cast<long>(processTreeWrapper.getTopProcessInfos(type, 5).size());
+            }
+        });
+
+        const double rankingsMs = measureMs(10, [&]() {
+            ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES, kRankingFlags};
+            sink += static_cast<long>(processTreeWrapper.getTopProcessInfoRankings(5).size());
+        });
+
+        g_sink = sink;
+
+        printf("Top 5 of all %zu rankings of this host: %.3f ms with a snapshot each, %.3f ms from one snapshot\n",
+               kTopInfoTypeCount,
+               separateMs,
+               rankingsMs);
+    }
+
+    printf("\n");
+}
+
+// The sscanf format _parseProcPidStat used before ProcStat_parse
+static bool sscanfProcStat(const char *buf, ProcStat_T *stat) {
+    const char *tmp = strrchr(buf, ')');
+
+    if (!tmp) {
+        return false;
+    }
+
+    return sscanf(tmp + 2,
+                  "%c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld %*d %*d %d %*u %llu %*u %ld %*u %*u %*u "
+                  "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %*d\n",
+                  &stat->state,
+                  &stat->ppid,
+                  &stat->utime,
+                  &stat->stime,
+                  &stat->cutime,
+                  &stat->cstime,
+                  &stat->threads,
+                  &stat->starttime,
+                  &stat->rss) == 9;
+}
+
+static void benchProcStat() {
+    std::vector<std::string> files;
+
+    if (DIR *dir = opendir("/proc")) {
+        while (const dirent *entry = readdir(dir)) {
+            if (entry->d_name[0] >= '1' && entry->d_name[0] <= '9') {
+                std::ifstream in{std::string("/proc/") + entry->d_name + "/stat"};
+                files.emplace_back(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            }
+        }
+
+        closedir(dir);
+    }
+
+    ProcStat_T stat{};
+    long sink = 0;
+
+    const double sscanfMs = measureMs(200, [&]() {
+        for (const std::string &file : files) {
+            sink += sscanfProcStat(file.c_str(), &stat) ? stat.threads : 0;
+        }
+    });
+
+    const double parseMs = measureMs(200, [&]() {
+        for (const std::string &file : files) {
+            sink += ProcStat_parse(file.c_str(), &stat) ? stat.threads : 0;
+        }
+    });
+
+    g_sink = sink;
+
+    printf("Parsing %zu stat files: sscanf %.1f ns, ProcStat_parse %.1f ns per file\n\n",
+           files.size(),
+           sscanfMs * 1e6 / static_cast<double>(files.size()),
+           parseMs * 1e6 / static_cast<double>(files.size()));
+}
+
+// What getTopProcessInfos did before TopK: push every process into a priority queue, then pop k
+static std::vector<const ProcessTree_T *> priorityQueueTopK(const std::vector<ProcessTree_T> &tree, size_t k) {
+    auto compare = [](const ProcessTree_T *p1, const ProcessTree_T *p2) {
+        return p1->cpu.usage.self < p2->cpu.usage.self;
+    };
+
+    std::priority_queue<const ProcessTree_T *, std::vector<const ProcessTree_T *>, decltype(compare)> pq{compare};
+
+    for (const ProcessTree_T &p : tree) {
+        if (p.pid > 0) {
+            pq.push(&p);
+        }
+    }
+
+    std::vector<const ProcessTree_T *> ret;
+
+    for (size_t i = 0; i < k && !pq.empty(); i++) {
+        ret.push_back(pq.top());
+        pq.pop();
+    }
+
+    return ret;
+}
+
+static void benchTopK() {
+    using namespace simple_process_monitor;
+
+    std::mt19937 rng{42};
+
+    printf("Top k processes by cpu usage, us per selection\n");
+    printf("%10s %4s %16s %16s\n", "processes", "k", "priority_queue", "TopK");
+
+    for (int n : {1000, 10000, 100000}) {
+        std::vector<ProcessTree_T> tree(static_cast<size_t>(n));
+
+        // Most processes are idle, like on a real host
+        std::uniform_real_distribution<float> usage{0.f, 100.f};
+
+        for (int i = 0; i < n; i++) {
+            tree[static_cast<size_t>(i)].pid = i + 1;
+            tree[static_cast<size_t>(i)].cpu.usage.self = i % 10 == 0 ? usage(rng) : 0.f;
+        }
+
+        for (size_t k : {5, 50}) {
+            long sink = 0;
+            const int rounds = n <= 10000 ? 200 : 20;
+
+            const double pqMs = measureMs(rounds, [&]() {
+                sink += static_cast<long>(priorityQueueTopK(tree, k).size());
+            });
+
+            const auto isProcess = [](const ProcessTree_T &p) {
+                return p.pid > 0;
+            };
+
+            const double topKMs = measureMs(rounds, [&]() {
+                sink += static_cast<long>(topK<ProcessCpuUsage>(tree.begin(), tree.end(), k, isProcess).size());
+            });
+
+            g_sink = sink;
+
+            printf("%10d %4zu %16.1f %16.1f\n", n, k, pqMs * 1000, topKMs * 1000);
+        }
+    }
+
+    printf("\n");
+}
+
+// One walk of /proc/*/task/*, with idle threads added to this process to look like a JVM host
+static void benchThreadCpuCollector() {
+    using namespace simple_process_monitor;
+
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> idle;
+
+    printf("ThreadCpuCollector update of all threads of this host, ms per update\n");
+    printf("%10s %10s %10s\n", "threads", "update", "top 5");
+
+    for (int n : {0, 1000, 4000}) {
+        while (static_cast<int>(idle.size()) < n) {
+            idle.emplace_back([&stop]() {
+                while (!stop) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds{500});
+                }
+            });
+        }
+
+        ThreadCpuCollector collector;
+        long sink = 0;
+
+        const double updateMs = measureMs(10, [&]() {
+            collector.update();
+        });
+
+        const double topMs = measureMs(10, [&]() {
+            sink += static_cast<long>(collector.getTopThreadInfos(5).size());
+        });
+
+        g_sink = sink;
+
+        printf("%10zu %10.3f %10.3f\n", collector.size(), updateMs, topMs);
+    }
+
+    stop = true;
+
+    for (std::thread &t : idle) {
+        t.join();
+    }
+
+    printf("\n");
+}
+
+// An hour at one sample per second of every process of this host
+static void benchProcessHistory() {
+    using namespace simple_process_monitor;
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES, kRankingFlags};
+    const std::shared_ptr<const ProcessTreeSnapshot> snapshot = processTreeWrapper.latest();
+    ProcessHistory history{3600, 256 * 1024 * 1024};
+    long long time = 0;
+
+    const double recordMs = measureMs(3600, [&]() {
+        history.record(time, *snapshot);
+        time += 1000;
+    });
+
+    double sink = 0;
+
+    // What a sparkline of every process reads: the CPU usages of the last minute
+    const double rangeMs = measureMs(100, [&]() {
+        for (const ProcessTree_T &p : *snapshot) {
+            if (const HistoryRing *ring = history.process(p.pid)) {
+                const auto [begin, end] = ring->find(time - 60000, time);
+                const ColumnRange<double> cpu = ring->values(HistoryMetric::CPU, begin, end);
+
+                for (size_t i = 0; i < cpu.firstSize; i++) {
+                    sink += cpu.first[i];
+                }
+
+                for (size_t i = 0; i < cpu.secondSize; i++) {
+                    sink += cpu.second[i];
+                }
+            }
+        }
+    });
+
+    g_sink = static_cast<long>(sink);
+
+    printf("ProcessHistory of %zu processes x 3600 samples: %.1f MiB, record %.3f ms, last minute of all %.3f ms\n\n",
+           history.processes(),
+           static_cast<double>(history.bytes()) / (1024 * 1024),
+           recordMs,
+           rangeMs);
+}
+
+// Half an hour of this host at about one sample per second, the values of real refreshes
+static void benchCompressedHistory() {
+    using namespace simple_process_monitor;
+
+    std::mt19937 rng{42};
+    std::uniform_int_distribution<int> jitter{-5, 5};
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES, kRankingFlags};
+    CompressedHistory history{24 * 3600 * 1000LL};
+    long long time = 0;
+
+    const double recordMs = measureMs(1800, [&]() {
+        processTreeWrapper.update();
+        time += 1000 + jitter(rng);
+        history.record(time, *processTreeWrapper.latest());
+    });
+
+    const CompressedSeries *self = history.process(getpid());
+    long sink = 0;
+
+    const double queryMs = measureMs(100, [&]() {
+        sink += static_cast<long>(self->query(0, time + 1).size());
+    });
+
+    g_sink = sink;
+
+    const double bytesPerSample = static_cast<double>(history.bytes()) / static_cast<double>(history.samples());
+
+    printf("CompressedHistory of %zu processes: %.2f bytes/sample (HistoryRing %zu), refresh and record %.3f ms, "
+           "decoding 30 min of a process %.3f ms\n",
+           history.processes(),
+           bytesPerSample,
+           HistoryRing{1}.bytes(),
+           recordMs,
+           queryMs);
+    printf("24 hours of 1000 processes at 1 s: %.0f MiB\n\n", bytesPerSample * 86400 * 1000 / (1024 * 1024));
+}
+
+static void benchRollupHistory() {
+    using namespace simple_process_monitor;
+
+    RollupSeries series{defaultRollupTiers()};
+    HistoryValues values{1., 4096., 0., 12.};
+    long long time = 0;
+
+    // Four weeks at 1 s, enough to fill every tier
+    const int samples = 4 * 7 * 24 * 3600;
+
+    const double pushMs = measureMs(1, [&]() {
+        for (int i = 0; i < samples; i++) {
+            time += 1000;
+            values[0] = i % 100;
+            series.push(time, values);
+        }
+    });
+
+    long sink = 0;
+
+    const double queryMs = measureMs(100, [&]() {
+        sink += static_cast<long>(series.query(0, time + 1, 3600 * 1000LL).size());
+    });
+
+    g_sink = sink;
+
+    printf("RollupSeries: push %.1f ns, a full series %.0f KiB (1000 processes %.0f MiB), "
+           "querying four weeks by hour %.3f ms\n\n",
+           pushMs * 1e6 / samples,
+           static_cast<double>(series.bytes()) / 1024,
+           static_cast<double>(series.bytes()) * 1000 / (1024 * 1024),
+           queryMs);
+}
+
+static void benchSharedSnapshot() {
+    using namespace simple_process_monitor;
+
+    const std::string name = "/simple_process_monitor_bench_" + std::to_string(getpid());
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES};
+    SystemInfo_T systemInfo;
+
+    init_system_info(&systemInfo);
+
+    SharedSnapshotPublisher publisher;
+    SharedSnapshotReader reader;
+    SharedSnapshot snapshot;
+
+    publisher.open(name);
+    reader.open(name);
+
+    const double refreshMs = measureMs(20, [&]() {
+        processTreeWrapper.update();
+    });
+
+    const double publishMs = measureMs(1000, [&]() {
+        publisher.publish(1, *processTreeWrapper.latest(), systemInfo);
+    });
+
+    long sink = 0;
+
+    const double readMs = measureMs(1000, [&]() {
+        sink += reader.read(snapshot);
+    });
+
+    g_sink = sink;
+
+    reader.close();
+    publisher.close();
+    SharedSnapshotPublisher::remove(name);
+
+    printf("Shared snapshot of %zu processes: publish %.4f ms, read %.4f ms, refresh instead %.3f ms\n\n",
+           snapshot.processes.size(),
+           publishMs,
+           readMs,
+           refreshMs);
+}
+
+static void benchMetricsExporter() {
+    using namespace simple_process_monitor;
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES};
+    SystemInfo_T systemInfo;
+
+    init_system_info(&systemInfo);
+    update_system_info(&systemInfo);
+
+    MetricsExporter exporter{MetricsExporterOptions{10, {}}};
+
+    const double updateMs = measureMs(1000, [&]() {
+        exporter.update(*processTreeWrapper.latest(), systemInfo);
+    });
+
+    printf("MetricsExporter: rendering a %zu B response %.4f ms, once per refresh for any number of scrapes\n\n",
+           exporter.response()->size(),
+           updateMs);
+}
+
+static void benchJsonWriter() {
+    using namespace simple_process_monitor;
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES};
+    const std::shared_ptr<const ProcessTreeSnapshot> snapshot = processTreeWrapper.latest();
+
+    std::vector<char> buf(1 << 20);
+    size_t bytes = 0;
+
+    const double writeMs = measureMs(1000, [&]() {
+        JsonWriter writer{buf.data(), buf.size()};
+
+        for (const ProcessTree_T &p : *snapshot) {
+            writeJson(writer, p);
+            writer.endRecord();
+        }
+
+        bytes = writer.view().size();
+    });
+
+    printf("JsonWriter: NDJSON of %d processes (%zu B) %.4f ms, %.0f MB/s\n\n",
+           snapshot->size(),
+           bytes,
+           writeMs,
+           static_cast<double>(bytes) / (writeMs * 1000));
+}
+
+static void benchAsyncLogger() {
+    using namespace simple_process_monitor;
+
+    // A sink as slow as a full disk or a remote syslog
+    const auto slowSink = [](std::string_view) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        return 0;
+    };
+
+    const std::string record(200, 'x');
+
+    const double directMs = measureMs(100, [&]() {
+        slowSink(record);
+    });
+
+    AsyncLogger logger{slowSink};
+
+    const double asyncMs = measureMs(100000, [&]() {
+        logger(record);
+    });
+
+    const AsyncLoggerStats stats = logger.stats();
+
+    printf("AsyncLogger with a 1 ms sink: logging %.3f us instead of %.3f ms, %llu records enqueued, %llu dropped\n\n",
+           asyncMs * 1000,
+           directMs,
+           static_cast<unsigned long long>(stats.enqueued),
+           static_cast<unsigned long long>(stats.dropped));
+}
+
+static void benchSegmentFile() {
+    using namespace simple_process_monitor;
+
+    const std::string path = "/tmp/simple_process_monitor_bench_" + std::to_string(getpid()) + ".seg";
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES};
+    SegmentWriter writer;
+    long long time = 0;
+
+    writer.open(path);
+
+    const double appendMs = measureMs(600, [&]() {
+        time += 1000;
+        writer.append(time, *processTreeWrapper.latest());
+    });
+
+    writer.close();
+
+    SegmentReader reader;
+
+    reader.open(path);
+
+    long long sink = 0;
+
+    // Every row of every block, as a query over the whole segment would
+    const double scanMs = measureMs(10, [&]() {
+        for (size_t block = 0; block < reader.blocks(); block++) {
+            size_t count = 0;
+            const SegmentRow *rows = reader.rows(block, &count);
+
+            for (size_t i = 0; i < count; i++) {
+                sink += rows[i].memory;
+            }
+        }
+    });
+
+    g_sink = static_cast<long>(sink);
+
+    struct stat st;
+
+    ::stat(path.c_str(), &st);
+    ::unlink(path.c_str());
+
+    printf("Segment of %zu blocks of %d processes: %.1f MiB, append %.3f ms, scanning all rows %.3f ms\n\n",
+           reader.blocks(),
+           processTreeWrapper.latest()->size(),
+           static_cast<double>(st.st_size) / (1024 * 1024),
+           appendMs,
+           scanMs);
+}
+
+int main() {
+    benchProcessTreeLinking();
+
+    benchProcStat();
+
+    benchTopK();
+
+    benchProcessTreeRefresh();
+
+    benchThreadCpuCollector();
+
+    benchProcessHistory();
+
+    benchCompressedHistory();
+
+    benchRollupHistory();
+
+    benchSegmentFile();
+
+    benchSharedSnapshot();
+
+    benchMetricsExporter();
+
+    benchJsonWriter();
+
+    benchAsyncLogger();
+
+    return 0;
+}
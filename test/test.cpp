@@ -1,9 +1,42 @@
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <climits>
+#include <cmath>
 #include <cstdarg>
 #include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
 #include <thread>
+#include <vector>
+
+#include "util/Arena.h"
+#include "util/ProcStat.h"
 
+#include <simple_process_monitor/async_logger.h>
+#include <simple_process_monitor/compressed_history.h>
+#include <simple_process_monitor/json_writer.h>
+#include <simple_process_monitor/metrics_exporter.h>
+#include <simple_process_monitor/process_history.h>
 #include <simple_process_monitor/process_monitor.h>
+#include <simple_process_monitor/report_builder.h>
+#include <simple_process_monitor/rollup_history.h>
+#include <simple_process_monitor/segment_file.h>
+#include <simple_process_monitor/shared_snapshot.h>
+#include <simple_process_monitor/top_k.h>
 
 static void testSystemInfo() {
     using namespace std::chrono_literals;
@@ -27,6 +60,400 @@ static void testSystemInfo() {
     printf("\n");
 }
 
+static void testArena() {
+    Arena_T arena = Arena_new(0);
+
+    // The last allocation grows in place, others are copied
+    auto *first = static_cast<int *>(Arena_calloc(arena, 4, sizeof(int)));
+    first[3] = 42;
+    assert(Arena_resize(arena, first, 4 * sizeof(int), 8 * sizeof(int)) == first);
+
+    char *s = Arena_dup(arena, "process");
+    auto *moved = static_cast<int *>(Arena_resize(arena, first, 8 * sizeof(int), 16 * sizeof(int)));
+    assert(moved != first && moved[3] == 42);
+    assert(strcmp(s, "process") == 0);
+
+    // Allocations bigger than a chunk, then a clear merges the chunks into one
+    for (int i = 0; i < 64; i++) {
+        memset(Arena_alloc(arena, 100000), i, 100000);
+    }
+
+    assert(Arena_used(arena) > 64 * 100000);
+
+    Arena_clear(arena);
+    assert(Arena_used(arena) == 0);
+
+    for (int i = 0; i < 64; i++) {
+        Arena_alloc(arena, 100000);
+    }
+
+    assert(Arena_used(arena) == 64 * 100000);
+
+    Arena_free(&arena);
+}
+
+static void testProcStat() {
+    ProcStat_T stat;
+
+    // The name may contain spaces and parentheses
+    assert(ProcStat_parse("1234 (a) b (c)) R 1 1234 1234 0 -1 4194560 1500 0 12 0 250 75 -3 -4 -2 5 7 0 998877 "
+                          "12345678 3000 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 3 0 0 0 0 0\n",
+                          &stat));
+    assert(strcmp(stat.comm, "a) b (c)") == 0);
+    assert(stat.state == 'R');
+    assert(stat.ppid == 1);
+    assert(stat.minflt == 1500);
+    assert(stat.majflt == 12);
+    assert(stat.utime == 250);
+    assert(stat.stime == 75);
+    assert(stat.cutime == -3);
+    assert(stat.cstime == -4);
+    assert(stat.priority == -2);
+    assert(stat.nice == 5);
+    assert(stat.threads == 7);
+    assert(stat.starttime == 998877);
+    assert(stat.rss == 3000);
+    assert(stat.processor == 3);
+
+    assert(!ProcStat_parse("", &stat));
+    assert(!ProcStat_parse("1234 (a) R 1 x", &stat));
+
+    // Compare with the fields the sscanf parser read
+    char buf[4096];
+    FILE *f = fopen("/proc/self/stat", "r");
+    assert(f);
+    const size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = 0;
+
+    char state;
+    int ppid;
+    unsigned long utime;
+    unsigned long stime;
+    int threads;
+    unsigned long long starttime;
+    long rss;
+
+    assert(sscanf(strrchr(buf, ')') + 2,
+                  "%c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %d %*u %llu %*u %ld",
+                  &state,
+                  &ppid,
+                  &utime,
+                  &stime,
+                  &threads,
+                  &starttime,
+                  &rss) == 7);
+    assert(ProcStat_parse(buf, &stat));
+    assert(stat.state == state && stat.ppid == ppid && stat.utime == utime && stat.stime == stime);
+    assert(stat.threads == threads && stat.starttime == starttime && stat.rss == rss);
+    assert(stat.processor >= 0);
+
+    printf("Parsed /proc/self/stat of %s, minflt %lu, processor %d\n\n", stat.comm, stat.minflt, stat.processor);
+}
+
+static void testTopK() {
+    using namespace simple_process_monitor;
+
+    struct Value {
+        int operator()(const std::pair<int, char> &p) const {
+            return p.first;
+        }
+    };
+
+    const std::vector<std::pair<int, char>> values{
+        {3, 'a'}, {9, 'b'}, {3, 'c'}, {7, 'd'}, {9, 'e'}, {1, 'f'}, {3, 'g'}};
+    const auto all = [](const std::pair<int, char> &) {
+        return true;
+    };
+
+    // Highest first, equal values in the order they were pushed
+    std::string names;
+
+    for (const auto *p : topK<Value>(values.begin(), values.end(), 4, all)) {
+        names += p->second;
+    }
+
+    assert(names == "beda");
+
+    assert(topK<Value>(values.begin(), values.end(), 0, all).empty());
+    assert(topK<Value>(values.begin(), values.end(), 100, all).size() == values.size());
+
+    // A huge k costs no more than the elements pushed
+    TopK<std::pair<int, char>, Value> unbounded{SIZE_MAX};
+
+    unbounded.push(values[0]);
+    assert(unbounded.take().size() == 1);
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES, kRankingFlags};
+
+    assert(!processTreeWrapper.getTopProcessInfoRankings(INT_MAX)[0].empty());
+    assert(!processTreeWrapper.getTopProcessInfos(TopInfoType::RAM, INT_MAX).empty());
+}
+
+static void testParallelProcessTree() {
+    ProcessTree_Context_T serialContext = ProcessTree_Context_new();
+    ProcessTree_Context_T parallelContext = ProcessTree_Context_new();
+
+    ProcessTree_Context_setWorkers(parallelContext, 4);
+
+    ProcessTree_T *serialTree = nullptr;
+    ProcessTree_T *parallelTree = nullptr;
+    int serialTreeSize = 0;
+    int parallelTreeSize = 0;
+
+    assert(ProcessTree_init(&serialTree, &serialTreeSize, serialContext, ALL_PROCESSES, ProcessTree_CollectAll) > 0);
+    assert(ProcessTree_init(&parallelTree, &parallelTreeSize, parallelContext, ALL_PROCESSES, ProcessTree_CollectAll) >
+           0);
+
+    // Processes may start or exit between the two scans, the common ones must be in the same order with the same data.
+    // A process may also exec or be reparented in between, so a few differences are tolerated except for this one.
+    int matched = 0;
+    int same = 0;
+
+    for (int i = 0, j = 0; i < serialTreeSize && j < parallelTreeSize;) {
+        if (serialTree[i].pid == parallelTree[j].pid) {
+            const bool isSame = serialTree[i].ppid == parallelTree[j].ppid &&
+                                std::string(serialTree[i].cmdline ? serialTree[i].cmdline : "") ==
+                                    std::string(parallelTree[j].cmdline ? parallelTree[j].cmdline : "");
+            assert(isSame || serialTree[i].pid != getpid());
+            same += isSame;
+            matched++;
+            i++;
+            j++;
+        } else if (serialTreeSize - i > parallelTreeSize - j) {
+            i++;
+        } else {
+            j++;
+        }
+    }
+
+    assert(matched > 0);
+    assert(same * 10 >= matched * 9);
+
+    printf("Serial and parallel process trees have %d and %d entries, %d matched\n\n",
+           serialTreeSize,
+           parallelTreeSize,
+           matched);
+
+    ProcessTree_delete(&serialTree, &serialTreeSize);
+    ProcessTree_delete(&parallelTree, &parallelTreeSize);
+    ProcessTree_Context_free(&serialContext);
+    ProcessTree_Context_free(&parallelContext);
+}
+
+static void testProcessTreeDescendants() {
+    ProcessTree_Context_T context = ProcessTree_Context_new();
+    ProcessTree_T *tree = nullptr;
+    int treeSize = 0;
+
+    assert(ProcessTree_init(&tree, &treeSize, context, ALL_PROCESSES, ProcessTree_CollectCpu) > 0);
+
+    int self = -1;
+    int root = -1;
+
+    for (int i = 0; i < treeSize; i++) {
+        if (tree[i].pid == getpid()) {
+            self = i;
+        }
+
+        if (tree[i].parent == i) {
+            root = i;
+        }
+    }
+
+    assert(self != -1 && root != -1);
+
+    // This process is a child of its parent
+    const int *children = nullptr;
+    const int childrenCount = ProcessTree_children(tree, treeSize, tree[self].parent, &children);
+    assert(std::find(children, children + childrenCount, self) != children + childrenCount);
+
+    // and a descendant of every ancestor, the root has all processes but itself as descendants
+    std::vector<int> descendants(static_cast<size_t>(treeSize));
+
+    for (int i = self; i != root; i = tree[i].parent) {
+        const int parent = tree[i].parent;
+        const int count = ProcessTree_descendants(tree, treeSize, parent, descendants.data(), treeSize);
+        assert(count == tree[parent].children.total);
+        assert(std::find(descendants.begin(), descendants.begin() + count, self) != descendants.begin() + count);
+    }
+
+    assert(ProcessTree_descendants(tree, treeSize, root, descendants.data(), treeSize) == treeSize - 1);
+    assert(ProcessTree_descendants(tree, treeSize, root, descendants.data(), treeSize - 2) == -1);
+
+    printf("Process tree has %d processes below the root, pid %d has %d children\n\n",
+           tree[root].children.total,
+           tree[tree[self].parent].pid,
+           childrenCount);
+
+    ProcessTree_delete(&tree, &treeSize);
+    ProcessTree_Context_free(&context);
+}
+
+static void testCollectProcessTree() {
+    ProcessTree_Context_T context = ProcessTree_Context_new();
+    ProcessTree_T *tree = nullptr;
+    int treeSize = 0;
+
+    assert(ProcessTree_init(&tree, &treeSize, context, ALL_PROCESSES, ProcessTree_CollectCpu) > 0);
+
+    int self = -1;
+
+    for (int i = 0; i < treeSize; i++) {
+        assert(!tree[i].cmdline);
+
+        if (tree[i].pid == getpid()) {
+            self = i;
+        }
+    }
+
+    assert(self != -1);
+    assert(ProcessTree_collect(tree, treeSize, context, self, ProcessTree_CollectCmdline));
+    assert(tree[self].cmdline && std::string(tree[self].cmdline).find("test") != std::string::npos);
+
+    printf("Collected cmdline of pid %d after ranking: %s\n\n", tree[self].pid, tree[self].cmdline);
+
+    // The next refresh takes the command line from the cache
+    const std::string cmdline = tree[self].cmdline;
+
+    assert(ProcessTree_init(&tree, &treeSize, context, ALL_PROCESSES, ProcessTree_CollectCmdline) > 0);
+
+    for (int i = 0; i < treeSize; i++) {
+        if (tree[i].pid == getpid()) {
+            assert(cmdline == tree[i].cmdline);
+        }
+    }
+
+    ProcessTree_delete(&tree, &treeSize);
+    ProcessTree_Context_free(&context);
+}
+
+static void testProcessTreeSnapshot() {
+    using namespace simple_process_monitor;
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES, ProcessTree_CollectCpu | ProcessTree_CollectCmdline};
+
+    const std::shared_ptr<const ProcessTreeSnapshot> first = processTreeWrapper.latest();
+
+    std::vector<pid_t> pids;
+
+    for (const ProcessTree_T &p : *first) {
+        pids.push_back(p.pid);
+    }
+
+    assert(!pids.empty());
+
+    // Readers walk the latest tree while it is refreshed
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> readers;
+
+    for (int i = 0; i < 4; i++) {
+        readers.emplace_back([&processTreeWrapper, &stop]() {
+            while (!stop) {
+                const std::shared_ptr<const ProcessTreeSnapshot> snapshot = processTreeWrapper.latest();
+
+                for (const ProcessTree_T &p : *snapshot) {
+                    assert(p.pid <= 0 || p.cmdline);
+                }
+
+                assert(snapshot->getTopProcessInfos(TopInfoType::CPU, 3).size() <= 3);
+            }
+        });
+    }
+
+    for (int i = 0; i < 20; i++) {
+        processTreeWrapper.update();
+    }
+
+    stop = true;
+
+    for (std::thread &reader : readers) {
+        reader.join();
+    }
+
+    // An old snapshot is not overwritten by the refreshes
+    assert(first->size() == static_cast<int>(pids.size()));
+
+    for (int i = 0; i < first->size(); i++) {
+        assert(first->begin()[i].pid == pids[static_cast<size_t>(i)]);
+    }
+
+    assert(processTreeWrapper.latest() != first);
+
+    // Snapshots kept past the limit of pinned arenas are copies, with their children and cmdlines
+    std::vector<std::shared_ptr<const ProcessTreeSnapshot>> kept{first};
+
+    for (int i = 0; i < 2 * ProcessTreeWrapper::kMaxPinnedArenas; i++) {
+        processTreeWrapper.update();
+        kept.push_back(processTreeWrapper.latest());
+    }
+
+    const ProcessTreeSnapshot &copy = *kept.back();
+
+    assert(first->pinned() && !copy.pinned());
+
+    for (int i = 0; i < copy.size(); i++) {
+        const int *children = nullptr;
+
+        for (int j = 0, n = ProcessTree_children(copy.begin(), copy.size(), i, &children); j < n; j++) {
+            assert(children[j] >= 0 && children[j] < copy.size() && copy.begin()[children[j]].parent == i);
+        }
+
+        assert(copy.begin()[i].pid <= 0 || copy.begin()[i].cmdline);
+    }
+
+    // Without cmdlines a snapshot names the processes after their stat files
+    ProcessTreeWrapper unnamed{ALL_PROCESSES, ProcessTree_CollectCpu};
+
+    for (const ProcessOrThreadInfo &info : unnamed.latest()->getTopProcessInfos(TopInfoType::THREADS, 3)) {
+        assert(!info.cmdline.empty() && info.cmdline != "(null)");
+    }
+}
+
+static void testTopProcessInfoRankings() {
+    using namespace simple_process_monitor;
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES, kRankingFlags};
+
+    const TopProcessInfoRankings rankings = processTreeWrapper.getTopProcessInfoRankings(5);
+
+    for (const TopProcessInfos &ranking : rankings) {
+        assert(!ranking.empty() && ranking.size() <= 5);
+
+        for (const ProcessOrThreadInfo &info : ranking) {
+            assert(info.cmdline != "(null)");
+        }
+    }
+
+    const auto isDescending = [](const TopProcessInfos &ranking, auto metric) {
+        for (size_t i = 1; i < ranking.size(); i++) {
+            if (metric(ranking[i - 1]) < metric(ranking[i])) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    assert(isDescending(rankings[static_cast<size_t>(TopInfoType::RAM)], [](const ProcessOrThreadInfo &info) {
+        return info.ramUsage;
+    }));
+    assert(isDescending(rankings[static_cast<size_t>(TopInfoType::IO)], [](const ProcessOrThreadInfo &info) {
+        return info.ioBytes;
+    }));
+    assert(isDescending(rankings[static_cast<size_t>(TopInfoType::FILE_DESCRIPTORS)],
+                        [](const ProcessOrThreadInfo &info) {
+                            return info.fileDescriptors;
+                        }));
+    assert(isDescending(rankings[static_cast<size_t>(TopInfoType::THREADS)], [](const ProcessOrThreadInfo &info) {
+        return info.threadNum;
+    }));
+
+    const ProcessOrThreadInfo &topIo = rankings[static_cast<size_t>(TopInfoType::IO)][0];
+
+    printf("Top I/O process %d has %lld bytes read and written\n\n", topIo.pid, topIo.ioBytes);
+}
+
 struct TestLogger {
     int operator()(const char *fmt, ...) {
         int ret = printf("TestLogger output: ");
@@ -41,6 +468,668 @@ struct TestLogger {
     }
 };
 
+static void testProcessCpuCollector() {
+    using namespace simple_process_monitor;
+
+    std::atomic<bool> stop{false};
+
+    // A busy thread of this process, to find this process and the thread in the top lists of one interval
+    std::thread busy{[&stop]() {
+        while (!stop) {
+        }
+    }};
+
+    ProcessCpuCollector collector{5};
+
+    assert(collector.processes().empty());
+    assert(collector.tracked() > 0 && collector.tracked() <= 10);
+
+    // The first interval ranks the candidates, the second one measures their threads
+    std::this_thread::sleep_for(std::chrono::milliseconds{500});
+    collector.update();
+    std::this_thread::sleep_for(std::chrono::seconds{1});
+    collector.update();
+
+    assert(collector.tracked() <= 10);
+
+    stop = true;
+    busy.join();
+
+    const TopProcessInfos &processes = collector.processes();
+
+    assert(!processes.empty() && processes.size() <= 5);
+    assert(collector.threads().size() == processes.size());
+
+    for (size_t i = 0; i < processes.size(); i++) {
+        if (processes[i].pid == getpid()) {
+            // Both threads of this process are measured over the same interval as the process
+            const TopProcessInfos &threads = collector.threads()[i];
+
+            assert(threads.size() >= 2);
+            assert(threads[0].pid != getpid() && threads[0].cpuUsage > 50.f);
+
+            // Named after the stat files the thread tree read
+            assert(threads[0].cmdline == "test");
+        }
+    }
+}
+
+static void testThreadCpuCollector() {
+    using namespace simple_process_monitor;
+
+    std::atomic<bool> stop{false};
+
+    std::thread busy{[&stop]() {
+        while (!stop) {
+        }
+    }};
+
+    ThreadCpuCollector collector;
+
+    assert(collector.size() > 0);
+    assert(collector.getTopThreadInfos(5).empty());
+
+    std::this_thread::sleep_for(std::chrono::seconds{1});
+    collector.update();
+
+    // Names are read for the top list, while the busy thread still runs
+    const TopThreadInfos threads = collector.getTopThreadInfos(5);
+
+    stop = true;
+    busy.join();
+
+    assert(!threads.empty() && threads.size() <= 5);
+
+    // The busy thread is found among the threads of all processes, with its process
+    const bool found = std::any_of(threads.begin(), threads.end(), [](const ThreadInfo &thread) {
+        return thread.pid == getpid() && thread.tid != getpid() && thread.cpuUsage > 50.f && thread.comm == "test";
+    });
+
+    assert(found);
+
+    // Without caching no stat file stays open, the next descriptor is the same before and after
+    const int before = dup(0);
+
+    close(before);
+
+    ThreadCpuCollector uncached{0};
+
+    uncached.update();
+    assert(uncached.size() > 0);
+
+    const int after = dup(0);
+
+    close(after);
+    assert(after == before);
+}
+
+static void testHistoryRing() {
+    using namespace simple_process_monitor;
+
+    HistoryRing ring{4};
+
+    assert(ring.find(0, 100).first == 0 && ring.find(0, 100).second == 0);
+
+    // Six samples wrap around a ring of four, 2..5 are kept
+    for (int i = 0; i < 6; i++) {
+        ring.push(i * 1000, {i * 10., i * 1., 0., 0.});
+    }
+
+    assert(ring.size() == 4 && ring.capacity() == 4);
+
+    const ColumnRange<long long> times = ring.times(0, ring.size());
+    const ColumnRange<double> cpu = ring.values(HistoryMetric::CPU, 0, ring.size());
+
+    assert(times.size() == 4 && times.secondSize == 2);
+
+    for (size_t i = 0; i < 4; i++) {
+        assert(times[i] == static_cast<long long>(i + 2) * 1000);
+        assert(cpu[i] == static_cast<double>(i + 2) * 10.);
+    }
+
+    // Samples of 3000 <= time < 5000
+    const auto [begin, end] = ring.find(2500, 5000);
+
+    assert(begin == 1 && end == 3);
+
+    const ColumnRange<double> rss = ring.values(HistoryMetric::RSS, begin, end);
+
+    assert(rss.size() == 2 && rss[0] == 3. && rss[1] == 4.);
+    assert(ring.find(6000, 7000).first == ring.find(6000, 7000).second);
+}
+
+static void testProcessHistory() {
+    using namespace simple_process_monitor;
+
+    std::atomic<bool> stop{false};
+    std::thread thread{[&stop]() {
+        while (!stop) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+    }};
+
+    // The threads of this process, to see one exit
+    ProcessTreeWrapper processTreeWrapper{getpid(), ProcessTree_CollectCpu};
+    ProcessHistory history{16, 1024 * 1024};
+
+    history.record(0, *processTreeWrapper.latest());
+
+    assert(history.processes() >= 2);
+    assert(history.process(getpid()) && history.process(getpid())->size() == 1);
+
+    const size_t processes = history.processes();
+
+    stop = true;
+    thread.join();
+
+    processTreeWrapper.update();
+    history.record(1000, *processTreeWrapper.latest());
+
+    // The exited thread was evicted, the rest got a second sample
+    assert(history.processes() == processes - 1);
+    assert(history.process(getpid())->size() == 2);
+    assert(history.bytes() <= 1024 * 1024);
+
+    SystemInfo_T systemInfo;
+
+    assert(init_system_info(&systemInfo));
+    assert(update_system_info(&systemInfo));
+
+    history.record(1000, systemInfo);
+
+    assert(history.system().size() == 1);
+    assert(history.system().values(HistoryMetric::RSS, 0, 1)[0] > 0);
+
+    // A budget of two rings tracks the system and one process
+    ProcessHistory small{16, 2 * HistoryRing::bytesOf(16)};
+
+    ProcessTreeWrapper allProcesses{ALL_PROCESSES, ProcessTree_CollectCpu};
+
+    small.record(0, *allProcesses.latest());
+
+    assert(small.processes() == 1);
+
+    // A pid reused by a process with another start time gets a new ring
+    ProcessTree_T reused[1] = {};
+
+    reused[0].pid = 1000000;
+    reused[0].starttime = 1;
+
+    history.record(2000, ProcessTreeSnapshot{reused, 1});
+    history.record(3000, ProcessTreeSnapshot{reused, 1});
+    assert(history.processes() == 1 && history.process(1000000)->size() == 2);
+
+    reused[0].starttime = 2;
+
+    history.record(4000, ProcessTreeSnapshot{reused, 1});
+    assert(history.process(1000000)->size() == 1);
+}
+
+static void testCompressedSeries() {
+    using namespace simple_process_monitor;
+
+    std::mt19937 rng{42};
+    std::uniform_int_distribution<int> jitter{-3, 3};
+    std::uniform_real_distribution<float> usage{0.f, 100.f};
+    std::uniform_int_distribution<long long> pages{-8, 8};
+
+    CompressedSeries series{100};
+    std::vector<HistorySample> samples;
+    long long time = 1700000000000;
+    HistoryValues values{-1., 4096. * 1000, 0., 12.};
+
+    // Idle stretches, busy stretches with jitter, and a gap after a stop
+    for (int i = 0; i < 1000; i++) {
+        time += i == 500 ? 3600000 : 1000 + jitter(rng);
+
+        if (i % 7 == 0) {
+            values[static_cast<size_t>(HistoryMetric::CPU)] = usage(rng);
+        }
+
+        values[static_cast<size_t>(HistoryMetric::RSS)] += 4096. * static_cast<double>(pages(rng));
+        values[static_cast<size_t>(HistoryMetric::IO)] += i % 3 == 0 ? 65536. : 0.;
+        values[static_cast<size_t>(HistoryMetric::FILE_DESCRIPTORS)] = i < 900 ? 12. : 1e12;
+
+        series.push(time, values);
+        samples.push_back({time, values});
+    }
+
+    assert(series.samples() == samples.size());
+
+    // Everything decodes exactly
+    const auto equal = [](const HistorySample &a, const HistorySample &b) {
+        return a.time == b.time && std::memcmp(a.values.data(), b.values.data(), sizeof(a.values)) == 0;
+    };
+
+    const std::vector<HistorySample> all = series.query(0, time + 1);
+
+    assert(all.size() == samples.size() && std::equal(all.begin(), all.end(), samples.begin(), equal));
+
+    // A range across chunk boundaries decodes only the samples in it
+    const std::vector<HistorySample> range = series.query(samples[150].time, samples[420].time);
+
+    assert(range.size() == 270 && std::equal(range.begin(), range.end(), samples.begin() + 150, equal));
+    assert(series.query(time + 1, time + 1000).empty());
+
+    // Far less than the 40 bytes of a sample in a HistoryRing
+    assert(series.bytes() < samples.size() * 16);
+
+    // Whole chunks older than the time are dropped
+    series.dropBefore(samples[250].time);
+
+    assert(series.samples() == 800);
+    assert(series.query(0, time + 1).front().time == samples[200].time);
+}
+
+static void testCompressedHistory() {
+    using namespace simple_process_monitor;
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES, kRankingFlags};
+    CompressedHistory history{60000, 10};
+
+    for (int i = 0; i < 100; i++) {
+        history.record(i * 1000, *processTreeWrapper.latest());
+    }
+
+    const CompressedSeries *self = history.process(getpid());
+
+    assert(self && self->samples() == 70);
+    assert(self->query(0, 100000).back().values[static_cast<size_t>(HistoryMetric::RSS)] > 0);
+    assert(history.processes() > 1 && history.bytes() > 0);
+}
+
+static void testRollupHistory() {
+    using namespace simple_process_monitor;
+
+    // By 10 s for a minute and by minute for 3 minutes
+    RollupSeries series{{{10000, 6}, {60000, 3}}};
+
+    // One sample a second for 10 minutes, the CPU usage counts the seconds of each minute
+    for (long long second = 0; second < 600; second++) {
+        series.push(second * 1000, HistoryValues{static_cast<double>(second % 60), 1., 0., 0.});
+    }
+
+    const auto cpu = static_cast<size_t>(HistoryMetric::CPU);
+
+    assert(series.tierOf(1000, 540000) == 0 && series.tierOf(60000, 540000) == 1 && series.tierOf(3600000, 0) == 1);
+
+    // The finer tier dropped the first minutes, they are read from the coarser one
+    assert(series.tierOf(1000, 530000) == 0 && series.tierOf(1000, 0) == 1);
+
+    // The last minute by 10 s, the open interval last
+    const std::vector<Rollup> fine = series.query(540000, 600000, 10000);
+
+    assert(fine.size() == 6);
+    assert(fine[0].time == 540000 && fine[0].count == 10 && fine[0].min[cpu] == 0 && fine[0].max[cpu] == 9);
+    assert(fine[5].time == 590000 && fine[5].last[cpu] == 59 && fine[5].average(HistoryMetric::CPU) == 54.5);
+
+    // Older minutes were dropped from the finer tier, the coarser one still spans them
+    assert(series.query(530000, 600000, 10000).front().time == 530000);
+
+    const std::vector<Rollup> coarse = series.query(0, 600000, 60000);
+
+    assert(series.query(0, 600000, 10000).size() == coarse.size());
+
+    assert(coarse.size() == 4 && coarse.front().time == 360000);
+    assert(coarse.front().count == 60 && coarse.front().average(HistoryMetric::CPU) == 29.5);
+    assert(coarse.back().max[cpu] == 59 && coarse.back().min[static_cast<size_t>(HistoryMetric::RSS)] == 1.);
+
+    // An unknown CPU usage counts as a sample but not in the CPU statistics
+    RollupSeries unknown{{{10000, 6}}};
+
+    unknown.push(0, HistoryValues{-1., 1., 0., 0.});
+
+    assert(unknown.query(0, 10000, 10000)[0].average(HistoryMetric::CPU) == -1.);
+
+    unknown.push(1000, HistoryValues{4., 3., 0., 0.});
+    unknown.push(2000, HistoryValues{-1., 2., 0., 0.});
+
+    const Rollup rollup = unknown.query(0, 10000, 10000)[0];
+
+    assert(rollup.count == 3 && rollup.counts[cpu] == 1 && rollup.min[cpu] == 4. && rollup.last[cpu] == 4.);
+    assert(rollup.average(HistoryMetric::CPU) == 4. && rollup.average(HistoryMetric::RSS) == 2.);
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES, kRankingFlags};
+    RollupHistory history;
+
+    history.record(0, *processTreeWrapper.latest());
+    processTreeWrapper.update();
+    history.record(1000, *processTreeWrapper.latest());
+
+    const RollupSeries *self = history.process(getpid());
+
+    assert(self && self->query(0, 2000, 60000).size() == 1 && self->query(0, 2000, 60000)[0].count == 2);
+    assert(history.processes() > 1 && history.bytes() > 0);
+}
+
+static void testSegmentFile() {
+    using namespace simple_process_monitor;
+
+    const std::string path = "/tmp/simple_process_monitor_test_" + std::to_string(getpid()) + ".seg";
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES};
+
+    {
+        SegmentWriter writer;
+
+        assert(writer.open(path));
+        assert(writer.append(1000, *processTreeWrapper.latest()));
+        assert(writer.append(2000, *processTreeWrapper.latest()));
+    }
+
+    // Continued after a restart, then cut off in the middle of the last block as by a crash
+    {
+        SegmentWriter writer;
+
+        assert(writer.open(path) && writer.blocks() == 2);
+        assert(!writer.append(1500, *processTreeWrapper.latest()));
+        assert(writer.append(3000, *processTreeWrapper.latest()));
+        assert(writer.append(4000, *processTreeWrapper.latest()));
+    }
+
+    struct stat st;
+
+    assert(::stat(path.c_str(), &st) == 0);
+    const auto cut = static_cast<off_t>(sizeof(SegmentFooter) + 4 * sizeof(SegmentIndexEntry) + 64);
+
+    assert(::truncate(path.c_str(), st.st_size - cut) == 0);
+
+    SegmentReader reader;
+
+    assert(reader.open(path) && reader.blocks() == 3);
+    assert(reader.time(2) == 3000);
+    assert(reader.find(500) == reader.blocks() && reader.find(2500) == 1 && reader.find(9000) == 2);
+
+    size_t count = 0;
+    const SegmentRow *rows = reader.rows(1, &count);
+
+    assert(count == static_cast<size_t>(processTreeWrapper.latest()->size()));
+
+    const SegmentRow *self = std::find_if(rows, rows + count, [](const SegmentRow &row) {
+        return row.pid == getpid();
+    });
+
+    assert(self != rows + count && self->memory > 0 && self->threads >= 1);
+    assert(std::strstr(reader.string(1, self->cmdline), "test"));
+
+    // The crashed segment is repaired when continued
+    {
+        SegmentWriter writer;
+
+        assert(writer.open(path) && writer.blocks() == 3);
+        assert(writer.append(5000, *processTreeWrapper.latest()));
+    }
+
+    assert(reader.open(path) && reader.blocks() == 4 && reader.time(3) == 5000);
+
+    reader.close();
+
+    // A block written in part, here past the file size limit, is cut off and the next one follows the last block
+    {
+        SegmentWriter writer;
+
+        assert(writer.open(path) && writer.blocks() == 4);
+
+        rlimit limit;
+
+        assert(::stat(path.c_str(), &st) == 0 && getrlimit(RLIMIT_FSIZE, &limit) == 0);
+
+        const rlimit small{static_cast<rlim_t>(st.st_size) + 1024, limit.rlim_max};
+        void (*handler)(int) = signal(SIGXFSZ, SIG_IGN);
+
+        assert(setrlimit(RLIMIT_FSIZE, &small) == 0);
+        assert(!writer.append(6000, *processTreeWrapper.latest()));
+        assert(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+        signal(SIGXFSZ, handler);
+
+        struct stat after;
+
+        assert(::stat(path.c_str(), &after) == 0 && after.st_size == st.st_size);
+        assert(writer.append(7000, *processTreeWrapper.latest()));
+    }
+
+    assert(reader.open(path) && reader.blocks() == 5 && reader.time(4) == 7000);
+
+    reader.close();
+
+    assert(::stat(path.c_str(), &st) == 0);
+
+    const int fd = ::open(path.c_str(), O_RDWR);
+    const off_t footerOffset = st.st_size - static_cast<off_t>(sizeof(SegmentFooter));
+    SegmentFooter footer;
+
+    assert(fd >= 0 && ::pread(fd, &footer, sizeof(footer), footerOffset) == static_cast<ssize_t>(sizeof(footer)));
+
+    // A footer whose index end wraps around to the footer is ignored, the blocks are scanned instead
+    SegmentFooter wrapping = footer;
+
+    wrapping.entries = 1U << 28;
+    wrapping.index = static_cast<uint64_t>(footerOffset) - uint64_t{wrapping.entries} * sizeof(SegmentIndexEntry);
+
+    assert(::pwrite(fd, &wrapping, sizeof(wrapping), footerOffset) == static_cast<ssize_t>(sizeof(wrapping)));
+    assert(reader.open(path) && reader.blocks() == 5 && reader.time(4) == 7000);
+    reader.close();
+    assert(::pwrite(fd, &footer, sizeof(footer), footerOffset) == static_cast<ssize_t>(sizeof(footer)));
+
+    // An index entry pointing out of the blocks rejects the segment
+
+    const SegmentIndexEntry bad{7000, static_cast<uint64_t>(st.st_size)};
+
+    assert(::pwrite(fd, &bad, sizeof(bad), static_cast<off_t>(footer.index + 4 * sizeof(SegmentIndexEntry))) ==
+           static_cast<ssize_t>(sizeof(bad)));
+    ::close(fd);
+
+    assert(!reader.open(path) && errno == EINVAL);
+
+    ::unlink(path.c_str());
+}
+
+static void testSharedSnapshot() {
+    using namespace simple_process_monitor;
+
+    const std::string name = "/simple_process_monitor_test_" + std::to_string(getpid());
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES};
+    SystemInfo_T systemInfo;
+
+    assert(init_system_info(&systemInfo));
+    assert(update_system_info(&systemInfo));
+
+    SharedSnapshotPublisher publisher;
+    SharedSnapshotReader reader;
+    SharedSnapshot snapshot;
+
+    assert(!reader.open(name));
+    assert(publisher.open(name, 4));
+    assert(reader.open(name) && !reader.read(snapshot));
+
+    // Only readable by this user
+    const std::string path = "/dev/shm" + name;
+    struct stat st;
+
+    assert(::stat(path.c_str(), &st) == 0 && (st.st_mode & 0777) == 0600);
+
+    // Readers copy consistent snapshots while the publisher goes on
+    std::atomic<bool> stop{false};
+    std::thread thread{[&]() {
+        for (long long time = 1; !stop; time++) {
+            publisher.publish(time, *processTreeWrapper.latest(), systemInfo);
+        }
+    }};
+
+    for (int reads = 0; reads < 1000;) {
+        if (reader.read(snapshot)) {
+            assert(snapshot.processes.size() == std::min<size_t>(snapshot.total, 4));
+            assert(snapshot.system.memory.usage.bytes == systemInfo.memory.usage.bytes);
+            reads++;
+        }
+    }
+
+    stop = true;
+    thread.join();
+
+    assert(reader.read(snapshot) && snapshot.time > 0 && snapshot.total > 4);
+
+    // A restarted publisher takes over the segment, with its mode, the reader keeps its mapping
+    publisher.close();
+    assert(publisher.open(name, 4, 0644));
+    assert(::stat(path.c_str(), &st) == 0 && (st.st_mode & 0777) == 0644);
+    publisher.publish(1LL << 40, *processTreeWrapper.latest(), systemInfo);
+    assert(reader.read(snapshot) && snapshot.time == 1LL << 40);
+
+    // A tree without processes
+    publisher.publish(1LL << 41, ProcessTreeSnapshot{nullptr, 0}, systemInfo);
+    assert(reader.read(snapshot) && snapshot.processes.empty());
+
+    publisher.close();
+    assert(SharedSnapshotPublisher::remove(name));
+
+    // Published by the sampler of a monitor
+    ProcessMonitor pm{ALL_PROCESSES, std::chrono::seconds{1}};
+
+    pm.publishSharedSnapshot(name);
+    pm.startSampling();
+    pm.logTopCpu([](std::string_view) {
+        return 0;
+    });
+
+    assert(reader.open(name) && reader.read(snapshot));
+
+    const auto self = std::find_if(snapshot.processes.begin(), snapshot.processes.end(), [](const SharedProcess &p) {
+        return p.pid == getpid();
+    });
+
+    assert(self != snapshot.processes.end() && std::strstr(self->cmdline, "test"));
+
+    pm.stopSampling();
+    reader.close();
+    assert(SharedSnapshotPublisher::remove(name));
+}
+
+static std::string httpGet(uint16_t port, const char *path) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+
+    sockaddr_in addr{};
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert(fd >= 0 && ::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == 0);
+
+    const std::string request = std::string{"GET "} + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+    assert(::write(fd, request.data(), request.size()) == static_cast<ssize_t>(request.size()));
+
+    std::string response;
+    char buf[4096];
+    ssize_t n;
+
+    while ((n = ::read(fd, buf, sizeof(buf))) > 0) {
+        response.append(buf, static_cast<size_t>(n));
+    }
+
+    ::close(fd);
+
+    return response;
+}
+
+static void testMetricsExporter() {
+    using namespace simple_process_monitor;
+
+    ProcessTreeWrapper processTreeWrapper{ALL_PROCESSES};
+    SystemInfo_T systemInfo;
+
+    assert(init_system_info(&systemInfo));
+    assert(update_system_info(&systemInfo));
+
+    // Only this process
+    MetricsExporter exporter{MetricsExporterOptions{0, {getpid()}}};
+
+    assert(exporter.listen(0) && exporter.port() != 0);
+
+    std::string response = httpGet(exporter.port(), "/metrics");
+
+    assert(response.find("HTTP/1.1 200 OK\r\n") == 0 && response.find("\r\n\r\n# EOF\n") != std::string::npos);
+
+    exporter.update(*processTreeWrapper.latest(), systemInfo);
+    response = httpGet(exporter.port(), "/metrics");
+
+    const std::string self = "{pid=\"" + std::to_string(getpid()) + "\",command=\"";
+
+    assert(response == *exporter.response());
+    assert(response.find("spm_system_memory_usage_bytes ") != std::string::npos);
+    assert(response.find("spm_process_memory_bytes" + self) != std::string::npos);
+    assert(response.find("spm_process_io_bytes_total" + self) != std::string::npos);
+    assert(response.find("spm_process_threads{pid=\"1\"") == std::string::npos);
+    assert(response.size() > 6 && response.compare(response.size() - 6, 6, "# EOF\n") == 0);
+
+    assert(httpGet(exporter.port(), "/other").find("HTTP/1.1 404") == 0);
+
+    // Invalid UTF-8 in a command is replaced, a long one is cut before the character which crosses the limit
+    std::string invalid = "bad\xff\xc3name --option";
+    std::string cut = std::string(63, 'a') + "\xc3\xa9";
+    ProcessTree_T commands[2] = {};
+
+    commands[0].pid = 1000000;
+    commands[0].cmdline = invalid.data();
+    commands[1].pid = 1000001;
+    commands[1].cmdline = cut.data();
+
+    MetricsExporter commandExporter{MetricsExporterOptions{0, {1000000, 1000001}}};
+
+    commandExporter.update(ProcessTreeSnapshot{commands, 2}, systemInfo);
+    response = *commandExporter.response();
+
+    assert(response.find("{pid=\"1000000\",command=\"bad\xef\xbf\xbd\xef\xbf\xbdname\"}") != std::string::npos);
+    assert(response.find("{pid=\"1000001\",command=\"" + std::string(63, 'a') + "\"}") != std::string::npos);
+
+    // A silent client is dropped after the connection timeout, the next scraper is served then
+    const int silent = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(exporter.port());
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert(silent >= 0 && ::connect(silent, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == 0);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    assert(httpGet(exporter.port(), "/metrics") == *exporter.response());
+    assert(std::chrono::steady_clock::now() - start < std::chrono::seconds{3});
+
+    char byte;
+
+    assert(::read(silent, &byte, 1) == 0);
+    ::close(silent);
+
+    // The top processes, fed by a sampling monitor
+    auto topExporter = std::make_shared<MetricsExporter>(MetricsExporterOptions{3, {}});
+    ProcessMonitor pm{ALL_PROCESSES, std::chrono::seconds{1}};
+
+    assert(topExporter->listen(0));
+
+    pm.exportMetrics(topExporter);
+    pm.startSampling();
+    pm.logTopRam([](std::string_view) {
+        return 0;
+    });
+
+    response = httpGet(topExporter->port(), "/metrics");
+
+    size_t processes = 0;
+
+    for (size_t i = response.find("spm_process_threads{"); i != std::string::npos;
+         i = response.find("spm_process_threads{", i + 1)) {
+        processes++;
+    }
+
+    assert(processes >= 1 && processes <= 6);
+
+    pm.stopSampling();
+}
+
 static void testProcessMonitor() {
     using namespace simple_process_monitor;
 
@@ -49,6 +1138,7 @@ static void testProcessMonitor() {
 
         pmAll.logTopCpuToStdout();
         pmAll.logTopRamToStdout();
+        pmAll.logTopThreadsToStdout();
     }
 
     {
@@ -71,10 +1161,366 @@ static void testProcessMonitor() {
     }
 }
 
+static void testReportBuilder() {
+    using namespace simple_process_monitor;
+
+    ReportBuilder report;
+    const std::string line(10000, 'x');
+
+    report.appendf("%d %s\n", 1, "one");
+    report.append("--\n");
+    report.appendf("%s\n", line.c_str());
+
+    // Nothing is truncated, and the view stays NUL-terminated
+    assert(report.view().size() == 6 + 3 + line.size() + 1);
+    assert(report.view().substr(0, 9) == "1 one\n--\n");
+    assert(report.view().data()[report.view().size()] == '\0');
+
+    report.clear();
+    assert(report.view().empty());
+}
+
+static void testJsonWriter() {
+    using namespace simple_process_monitor;
+
+    char buf[256];
+
+    {
+        JsonWriter writer{buf, sizeof(buf)};
+
+        writer.beginObject()
+            .key("a")
+            .beginArray()
+            .value(1)
+            .value(-9223372036854775807LL - 1)
+            .value(0.1f)
+            .value(std::nan(""))
+            .value(true)
+            .null()
+            .endArray()
+            .key("s")
+            .value("q\"b\\n\n\x01 \xc3\xa9 \xff\xc3")
+            .key("e")
+            .beginObject()
+            .endObject()
+            .endObject()
+            .endRecord();
+
+        assert(writer.ok());
+        assert(writer.view() ==
+               "{\"a\":[1,-9223372036854775808,0.1,null,true,null],"
+               "\"s\":\"q\\\"b\\\\n\\n\\u0001 \xc3\xa9 \\ufffd\\ufffd\",\"e\":{}}\n");
+    }
+
+    // Without output, what does not fit is lost
+    {
+        JsonWriter writer{buf, 8};
+
+        writer.value("0123456789");
+        assert(!writer.ok());
+    }
+
+    // Through a small buffer into a pipe
+    int fds[2];
+
+    assert(::pipe(fds) == 0);
+
+    ProcessTreeWrapper processTreeWrapper{getpid()};
+    SystemInfo_T systemInfo;
+
+    assert(init_system_info(&systemInfo));
+    assert(update_system_info(&systemInfo));
+
+    {
+        JsonWriter writer{fds[1], buf, 16};
+
+        writer.beginArray();
+        writeJson(writer, *processTreeWrapper.latest()->begin());
+        writeJson(writer, systemInfo);
+        writer.endArray().endRecord();
+
+        assert(writer.flush());
+    }
+
+    ::close(fds[1]);
+
+    std::string json;
+    ssize_t n;
+
+    while ((n = ::read(fds[0], buf, sizeof(buf))) > 0) {
+        json.append(buf, static_cast<size_t>(n));
+    }
+
+    ::close(fds[0]);
+
+    assert(json.find("[{\"pid\":" + std::to_string(getpid()) + ",") == 0);
+    assert(json.find("\"loadavg\":[") != std::string::npos && json.back() == '\n');
+    assert(std::count(json.begin(), json.end(), '{') == std::count(json.begin(), json.end(), '}'));
+
+    // Reports of a monitor
+    ProcessMonitor pm{ALL_PROCESSES};
+
+    pm.setReportFormat(ReportFormat::NDJSON);
+    pm.logTopRam([](std::string_view s) {
+        assert(s.find("{\"report\":\"top_ram\",\"time\":") == 0);
+        assert(s.find("\"processes\":[{\"pid\":") != std::string_view::npos);
+        assert(s.find('\n') == s.size() - 1);
+    });
+}
+
+static void testAsyncLogger() {
+    using namespace simple_process_monitor;
+
+    // A slow sink drops what does not fit instead of stalling the producer
+    {
+        std::string log;
+        AsyncLogger logger{[&log](std::string_view s) {
+                               std::this_thread::sleep_for(std::chrono::milliseconds{20});
+                               log += s;
+                               return static_cast<int>(s.size());
+                           },
+                           AsyncLoggerOptions{4, 64, OverflowPolicy::DROP, std::chrono::milliseconds{0}}};
+
+        const auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < 100; i++) {
+            logger("record\n");
+        }
+
+        assert(std::chrono::steady_clock::now() - start < std::chrono::milliseconds{20});
+
+        logger.flush();
+
+        const AsyncLoggerStats stats = logger.stats();
+
+        assert(stats.dropped > 0 && stats.enqueued + stats.dropped == 100);
+        assert(std::count(log.begin(), log.end(), '\n') == static_cast<long>(stats.enqueued));
+    }
+
+    // Blocking producers lose nothing, records are written in batches
+    {
+        std::string log;
+        AsyncLogger logger{[&log](std::string_view s) {
+                               log += s;
+                               return static_cast<int>(s.size());
+                           },
+                           AsyncLoggerOptions{16, 64, OverflowPolicy::BLOCK, std::chrono::milliseconds{10000}}};
+
+        std::vector<std::thread> producers;
+
+        for (int t = 0; t < 4; t++) {
+            producers.emplace_back([&logger, t]() {
+                for (int i = 0; i < 1000; i++) {
+                    assert(logger.log(std::to_string(t * 1000 + i) + "\n"));
+                }
+            });
+        }
+
+        for (std::thread &producer : producers) {
+            producer.join();
+        }
+
+        logger.flush();
+
+        assert(logger.stats().enqueued == 4000 && logger.stats().dropped == 0);
+        assert(logger.stats().batches <= 4000);
+
+        std::vector<int> records;
+        size_t begin = 0;
+
+        for (size_t end = log.find('\n'); end != std::string::npos; begin = end + 1, end = log.find('\n', begin)) {
+            records.push_back(std::stoi(log.substr(begin, end - begin)));
+        }
+
+        std::sort(records.begin(), records.end());
+
+        assert(records.size() == 4000 && records.front() == 0 && records.back() == 3999);
+        assert(std::adjacent_find(records.begin(), records.end()) == records.end());
+    }
+
+    // A flush concurrent with a producer waits for every record logged before it
+    {
+        std::mutex mutex;
+        size_t written = 0;
+        AsyncLogger logger{[&mutex, &written](std::string_view s) {
+                               std::lock_guard<std::mutex> lock{mutex};
+
+                               written += static_cast<size_t>(std::count(s.begin(), s.end(), '\n'));
+                               return static_cast<int>(s.size());
+                           },
+                           AsyncLoggerOptions{64, 8, OverflowPolicy::BLOCK, std::chrono::milliseconds{10000}}};
+
+        std::atomic<size_t> logged{0};
+        std::thread producer{[&logger, &logged]() {
+            for (int i = 0; i < 10000; i++) {
+                logger.log("record\n");
+                logged.fetch_add(1);
+            }
+        }};
+
+        for (int i = 0; i < 100; i++) {
+            const size_t before = logged.load();
+
+            logger.flush();
+
+            std::lock_guard<std::mutex> lock{mutex};
+
+            assert(written >= before);
+        }
+
+        producer.join();
+    }
+
+    // Failed sink calls are counted, an idle drainer still wakes up for a record
+    {
+        AsyncLogger logger{[](std::string_view) {
+            return -1;
+        }};
+
+        logger("record\n");
+        logger.flush();
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        logger("record\n");
+        logger.flush();
+
+        assert(logger.stats().failed == logger.stats().batches && logger.stats().failed >= 2);
+    }
+
+    // As the sink of a monitor, the report is written when the logger is destroyed at the latest
+    std::string log;
+
+    {
+        AsyncLogger logger{[&log](std::string_view s) {
+            log += s;
+            return static_cast<int>(s.size());
+        }};
+
+        ProcessMonitor{ALL_PROCESSES}.logTopRam(logger);
+    }
+
+    assert(log.find("RAM usages") != std::string::npos);
+}
+
+static void testProcessMonitorSampling() {
+    using namespace simple_process_monitor;
+
+    ProcessMonitor pm{ALL_PROCESSES, std::chrono::seconds{1}};
+
+    pm.sampleThreads(true);
+    pm.startSampling();
+
+    std::string log;
+
+    auto logger = [&log](std::string_view s) {
+        log += s;
+        return static_cast<int>(s.size());
+    };
+
+    // Only the first call waits for an interval
+    pm.logTopCpu(logger);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    pm.logTopCpu(logger);
+    pm.logTopRam(logger);
+    pm.logTopThreads(logger);
+
+    assert(std::chrono::steady_clock::now() - start < std::chrono::milliseconds{500});
+    assert(log.find("CPU usages") != std::string::npos);
+    assert(log.find("RAM usages") != std::string::npos);
+    assert(log.find("system threads' CPU usages") != std::string::npos);
+
+    // A whole report is one call of the sink, of any callable type
+    struct CountingSink {
+        int &calls;
+
+        void operator()(std::string_view s) const {
+            assert(s.find("CPU usages") != std::string::npos && s.back() == '\n');
+            calls++;
+        }
+    };
+
+    int calls = 0;
+
+    pm.logTopCpu(CountingSink{calls});
+    assert(calls == 1);
+
+    // Stopping wakes the sampler up in the middle of an interval
+    pm.stopSampling();
+
+    assert(std::chrono::steady_clock::now() - start < std::chrono::milliseconds{500});
+
+    // And logging blocks again
+    pm.logTopRamToStdout();
+
+    // The sampler feeds a history
+    ProcessMonitor self{getpid(), std::chrono::seconds{1}};
+    std::mutex historyMutex;
+    RollupHistory history;
+
+    self.recordSamples([&](long long time, const ProcessTreeSnapshot &snapshot, const SystemInfo_T &systemInfo) {
+        std::lock_guard<std::mutex> lock{historyMutex};
+
+        history.record(time, snapshot);
+        history.record(time, systemInfo);
+    });
+    self.startSampling();
+    self.logTopRam(logger);
+    self.stopSampling();
+
+    std::lock_guard<std::mutex> lock{historyMutex};
+
+    assert(history.process(getpid()) != nullptr);
+}
+
 int main() {
     testSystemInfo();
 
+    testArena();
+
+    testProcStat();
+
+    testTopK();
+
+    testParallelProcessTree();
+
+    testCollectProcessTree();
+
+    testProcessTreeDescendants();
+
+    testProcessTreeSnapshot();
+
+    testTopProcessInfoRankings();
+
+    testProcessCpuCollector();
+
+    testThreadCpuCollector();
+
+    testHistoryRing();
+
+    testProcessHistory();
+
+    testCompressedSeries();
+
+    testCompressedHistory();
+
+    testRollupHistory();
+
+    testSegmentFile();
+
+    testSharedSnapshot();
+
+    testMetricsExporter();
+
     testProcessMonitor();
 
+    testReportBuilder();
+
+    testJsonWriter();
+
+    testAsyncLogger();
+
+    testProcessMonitorSampling();
+
     return 0;
 }